@@ -1,18 +1,96 @@
 #include <sys/signalfd.h>
+#include <thread>
 #include "proxy/proxy_server.h"
+#include "proxy/multi_proxy_server.h"
+#include "proxy/util/byte_scan.h"
+
+// Usage: proxy_server [port] [reactors] [--edge-triggered] [--batch-updates] [--backend=epoll|uring]
+//                     [--accept-budget=N] [--handler-budget=bytes] [--busy-poll=us] [--socket-busy-poll]
+//                     [--no-splice] [--tunnel-buffer=bytes] [--max-cached-body=bytes]
+//                     [--high-watermark=bytes] [--low-watermark=bytes] [--zerocopy=bytes] [--no-submit-sends]
+// Number of reactors: 1 for single-threaded server, 0 for one reactor per CPU core
+proxy_options parse_options(int argc, char **args) {
+    proxy_options options;
+    size_t position = 0;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = args[i];
+        if (arg.compare(0, 2, "--") != 0) {
+            if (position == 0) {
+                options.port = (uint16_t) std::stoi(arg);
+            } else if (position == 1) {
+                options.reactors = (size_t) std::stoi(arg);
+            }
+            position++;
+        } else if (arg == "--edge-triggered") {
+            options.edge_triggered = true;
+        } else if (arg == "--level-triggered") {
+            options.edge_triggered = false;
+        } else if (arg == "--batch-updates") {
+            options.batch_updates = true;
+        } else if (arg.compare(0, 16, "--accept-budget=") == 0) {
+            options.accept_budget = std::max((size_t) std::stoul(arg.substr(16)), (size_t) 1);
+        } else if (arg.compare(0, 17, "--handler-budget=") == 0) {
+            options.handler_budget = (size_t) std::stoul(arg.substr(17));
+        } else if (arg.compare(0, 12, "--busy-poll=") == 0) {
+            options.busy_poll = (size_t) std::stoul(arg.substr(12));
+        } else if (arg == "--socket-busy-poll") {
+            options.socket_busy_poll = true;
+        } else if (arg == "--no-splice") {
+            options.splice_tunnel = false;
+        } else if (arg.compare(0, 16, "--tunnel-buffer=") == 0) {
+            options.tunnel_buffer = std::max((size_t) std::stoul(arg.substr(16)), (size_t) 1);
+        } else if (arg.compare(0, 18, "--max-cached-body=") == 0) {
+            options.max_cached_body = (size_t) std::stoul(arg.substr(18));
+        } else if (arg.compare(0, 17, "--high-watermark=") == 0) {
+            options.high_watermark = (size_t) std::stoul(arg.substr(17));
+        } else if (arg.compare(0, 16, "--low-watermark=") == 0) {
+            options.low_watermark = (size_t) std::stoul(arg.substr(16));
+        } else if (arg.compare(0, 11, "--zerocopy=") == 0) {
+            options.zerocopy_threshold = (size_t) std::stoul(arg.substr(11));
+        } else if (arg == "--backend=epoll") {
+            options.backend = epoll_core::EPOLL;
+        } else if (arg == "--backend=uring") {
+            options.backend = epoll_core::URING;
+        } else if (arg == "--no-submit-sends") {
+            options.submit_sends = false;
+        } else {
+            throw annotated_exception("options", "unknown option " + arg);
+        }
+    }
+    // Reading, that stops at high watermark, should resume only after the most of data is sent. Otherwise it would
+    // stop and resume on every write, and with zero high watermark it would never start
+    if (options.low_watermark >= options.high_watermark) {
+        throw annotated_exception("options", "low watermark (" + std::to_string(options.low_watermark) +
+                                             ") should be lower than high watermark (" +
+                                             std::to_string(options.high_watermark) + ")");
+    }
+    if (options.reactors == 0) {
+        options.reactors = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    return options;
+}
 
 int main(int argc, char **args) {
     try {
-        uint16_t port = 8080;
-        if (argc > 1) {
-            port = (uint16_t) std::stoi(args[1]);
+        proxy_options options = parse_options(argc, args);
+        std::string tag = "server on port " + std::to_string(options.port);
+        log("header scanning", byte_scan::kernels());
+
+        if (options.reactors == 1) {
+            proxy_server proxy(options);
+            log(tag, "started");
+            proxy.run();
+        } else {
+            multi_proxy_server proxy(options);
+            log(tag, "started with " + std::to_string(options.reactors) + " reactors");
+            proxy.run();
         }
-        proxy_server proxy(200, port, 200);
-        std::string tag = "server on port " + std::to_string(port);
-        log(tag, "started");
-        proxy.run();
 
     } catch (annotated_exception const &e) {
         log(e);
+        return 1;
+    } catch (std::logic_error const &e) {
+        log("options", e.what());
+        return 1;
     }
 }
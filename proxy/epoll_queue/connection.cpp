@@ -1,9 +1,18 @@
 #include "connection.h"
 
-connection::connection() : timeout(0), expires_in(0) {}
+connection::connection() : timeout(0) {}
 
-connection::connection(epoll_elem &&client, epoll_elem &&server, size_t timeout, size_t ticks) :
-        timeout(timeout), expires_in(ticks + timeout), client(std::move(client)), server(std::move(server)) {}
+connection::connection(epoll_elem &&client, epoll_elem &&server, size_t timeout) :
+        timeout(timeout), client(std::move(client)), server(std::move(server)) {}
+
+connection::connection(connection &&other) : connection() {
+    swap(*this, other);
+}
+
+connection &connection::operator=(connection &&other) {
+    swap(*this, other);
+    return *this;
+}
 
 socket_wrap const &connection::get_client() const {
     return *static_cast<socket_wrap const *>(&client.get_fd());
@@ -26,7 +35,6 @@ void swap(connection &first, connection &second) {
     swap(first.client, second.client);
     swap(first.server, second.server);
     swap(first.timeout, second.timeout);
-    swap(first.expires_in, second.expires_in);
 }
 
 std::string to_string(connection const &conn) {
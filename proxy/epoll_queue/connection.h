@@ -9,11 +9,11 @@
 struct connection {
     connection();
 
-    connection(epoll_elem &&client, epoll_elem &&server, size_t timeout, size_t ticks);
+    connection(epoll_elem &&client, epoll_elem &&server, size_t timeout);
 
-    connection(connection &&other) = default;
+    connection(connection &&other);
 
-    connection &operator=(connection &&other) = default;
+    connection &operator=(connection &&other);
 
     socket_wrap const &get_client() const;
 
@@ -29,7 +29,9 @@ struct connection {
 
     void change_timeout(size_t new_timeout);
 
-    size_t timeout, expires_in;
+    size_t timeout;
+    // Timer of connection in epoll_queue. It's bound to the place of connection, so it isn't moved with it
+    timing_wheel::timer timer;
 
 private:
     epoll_elem client, server;
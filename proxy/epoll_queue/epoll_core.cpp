@@ -1,11 +1,17 @@
+#include <sys/socket.h>
 #include "epoll_core.h"
 #include "../util/annotated_exception.h"
 
 
-epoll_core::epoll_core(int max_queue_size) :
+epoll_core::epoll_core(int max_queue_size, backend type) :
         file_descriptor(), queue_size(max_queue_size), events(
-        new epoll_event[max_queue_size]), handlers{}, started{false}, stopped{
+        new epoll_event[max_queue_size]), handlers{}, ready{}, changes{}, deferred{}, cancels{}, batch_updates(false),
+        busy_poll(0), handler_budget(DEFAULT_HANDLER_BUDGET), budget_left(0), stats(), ring(), started{false}, stopped{
         true} {
+    if (type == URING) {
+        ring.reset(new uring((unsigned) max_queue_size));
+        return;
+    }
     fd = epoll_create(1);
     if (fd == -1) {
         int err = errno;
@@ -17,48 +23,516 @@ epoll_core::epoll_core(epoll_core &&other) {
     swap(*this, other);
 }
 
+static const uint32_t EDGE_EVENTS = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+
+// Data of io_uring sends is address of send_request with this bit. Generations don't reach it
+static const uint64_t SEND_REQUEST = (uint64_t) 1 << 63;
+static const uint32_t GENERATION_MASK = 0x7fffffff;
+
+epoll_core::statistics::statistics() : ctl_calls(0), ctl_saved(0), wait_calls(0), submissions(0), accepted(0),
+                                           sends(0), requeued(0), spin_time(0), sleep_time(0) {}
+
+epoll_core::handler_slot::handler_slot() : handler(), replacement(), generation(0), interest(0), registered(0),
+                                           active(false), running(false), replaced(false), changed(false),
+                                           armed(false), edge(false), hangup(false), accepting(false), accepted(),
+                                           sending(0), completed(0) {}
+
 epoll_event epoll_core::create_event(int fd, fd_state const &st) {
     epoll_event event;
     memset(&event, 0, sizeof event);
-    event.data.fd = fd;
+    // Descriptor in lower half, generation of its registration in upper half
+    event.data.u64 = ((uint64_t) get_slot(fd).generation << 32) | (uint32_t) fd;
     event.events = st.get();
     return event;
 }
 
+epoll_core::handler_slot &epoll_core::get_slot(int fd) {
+    if ((size_t) fd >= handlers.size()) {
+        handlers.resize((size_t) fd + 1);
+    }
+    return handlers[fd];
+}
+
+void epoll_core::set_handler(handler_slot &slot, handler_t handler) {
+    if (slot.running) {
+        slot.replacement = std::move(handler);
+        slot.replaced = true;
+    } else {
+        slot.handler = std::move(handler);
+    }
+}
+
 void epoll_core::register_fd(const file_descriptor &fd, fd_state events) {
-    epoll_event event = create_event(fd.get(), events);
+    handler_slot &slot = get_slot(fd.get());
+    slot.generation = (slot.generation + 1) & GENERATION_MASK;
+    slot.edge = events.is(fd_state::EDGE);
+    slot.interest = events.get() & ~EPOLLET;
+    slot.hangup = false;
+    slot.completed = 0;
+    slot.changed = false;
+    epoll_event event = create_event(fd.get(), slot.edge ? fd_state(EDGE_EVENTS) : events);
 
-    if (epoll_ctl(this->fd, EPOLL_CTL_ADD, fd.get(), &event)) {
-        int err = errno;
-        throw annotated_exception("epoll register", err);
+    if (ring) {
+        slot.registered = event.events & ~EPOLLET;
+        poll(fd.get(), slot);
+    } else {
+        stats.ctl_calls++;
+        if (epoll_ctl(this->fd, EPOLL_CTL_ADD, fd.get(), &event)) {
+            int err = errno;
+            throw annotated_exception("epoll register", err);
+        }
+        slot.registered = event.events;
     }
+    slot.active = true;
+    set_handler(slot, handler_t());
 }
 
 void epoll_core::register_fd(const file_descriptor &fd, fd_state events,
                              handler_t handler) {
     register_fd(fd, events);
-    handlers.insert({fd.get(), handler});
+    set_handler(get_slot(fd.get()), std::move(handler));
 }
 
 void epoll_core::unregister_fd(const file_descriptor &fd) {
-    if (epoll_ctl(this->fd, EPOLL_CTL_DEL, fd.get(), 0)) {
-        int err = errno;
-        throw annotated_exception("epoll_unregister", err);
+    handler_slot &slot = get_slot(fd.get());
+    if (ring) {
+        uint64_t data = create_event(fd.get(), fd_state()).data.u64;
+        if (slot.armed) {
+            cancel(data, !slot.accepting);
+            slot.armed = false;
+        }
+        for (int accepted : slot.accepted) {
+            if (accepted >= 0) {
+                close(accepted);
+            }
+        }
+        slot.accepted.clear();
+        slot.accepting = false;
+        // Sends keep memory until completion, and cancel makes it sooner
+        for (auto it = sends.begin(); slot.sending != 0 && it != sends.end(); it++) {
+            if (it->data == data) {
+                stats.submissions++;
+                try {
+                    ring->cancel(SEND_REQUEST | (uint64_t) &*it);
+                } catch (annotated_exception const &) {
+                    // Send isn't cancelled and is completed by kernel
+                }
+            }
+        }
+    } else {
+        stats.ctl_calls++;
+        if (epoll_ctl(this->fd, EPOLL_CTL_DEL, fd.get(), 0)) {
+            int err = errno;
+            throw annotated_exception("epoll_unregister", err);
+        }
     }
-    handlers.erase(fd.get());
+    slot.active = false;
+    set_handler(slot, handler_t());
 }
 
 void epoll_core::update_fd(const file_descriptor &fd, fd_state events) {
-    epoll_event event = create_event(fd.get(), events);
-    if (epoll_ctl(this->fd, EPOLL_CTL_MOD, fd.get(), &event)) {
+    handler_slot &slot = get_slot(fd.get());
+    uint32_t interest = events.get() & ~EPOLLET;
+    if (slot.edge) {
+        // Edges, that happened while handler wasn't interested in them, are lost. So handler is called
+        // for newly added events and should find out by itself, whether descriptor is ready
+        uint32_t added = interest & ~slot.interest & (EPOLLIN | EPOLLOUT);
+        slot.interest = interest;
+        if (added != 0) {
+            schedule(fd.get(), added | (slot.hangup ? (interest & EPOLLRDHUP) : 0));
+        }
+        stats.ctl_saved++;
+        return;
+    }
+    slot.interest = interest;
+
+    // io_uring always waits for the end of round, changes are submitted together with waiting
+    if (batch_updates || ring) {
+        // Events, that handler isn't interested in anymore, are filtered out in dispatch
+        if (slot.changed) {
+            stats.ctl_saved++;
+        } else {
+            slot.changed = true;
+            changes.push_back(fd.get());
+        }
+        return;
+    }
+    modify(fd.get(), slot);
+}
+
+void epoll_core::modify(int fd, handler_slot &slot) {
+    epoll_event event = create_event(fd, fd_state(slot.interest));
+    stats.ctl_calls++;
+    if (epoll_ctl(this->fd, EPOLL_CTL_MOD, fd, &event)) {
         int err = errno;
         throw annotated_exception("epoll_update", err);
     }
+    slot.registered = slot.interest;
+}
+
+void epoll_core::apply_changes() {
+    if (ring) {
+        changes.insert(changes.end(), deferred.begin(), deferred.end());
+        deferred.clear();
+        std::vector<uint64_t> retried;
+        retried.swap(cancels);
+        for (uint64_t data : retried) {
+            cancel(data, false);
+        }
+    }
+    for (auto it = changes.begin(); it != changes.end(); it++) {
+        handler_slot &slot = handlers[*it];
+        if (!slot.changed) {
+            continue;
+        }
+        slot.changed = false;
+        if (ring && slot.accepting) {
+            arm_accept(*it, slot);
+            continue;
+        }
+        if (ring && slot.active && !slot.armed) {
+            // Poll was completed, and should be armed again
+            poll(*it, slot);
+            continue;
+        }
+        // Descriptor was unregistered, or its events returned to registered ones
+        if (!slot.active || slot.edge || slot.interest == slot.registered) {
+            stats.ctl_saved++;
+            continue;
+        }
+        if (ring) {
+            stats.submissions++;
+            try {
+                ring->poll_update(create_event(*it, fd_state()).data.u64, slot.interest);
+            } catch (annotated_exception const &) {
+                defer(*it, slot);
+                continue;
+            }
+            slot.registered = slot.interest;
+            continue;
+        }
+        modify(*it, slot);
+    }
+    changes.clear();
+}
+
+void epoll_core::arm_accept(int fd, handler_slot &slot) {
+    bool interested = slot.active && (slot.interest & EPOLLIN) != 0;
+    if (interested == slot.armed) {
+        stats.ctl_saved++;
+        return;
+    }
+    stats.submissions++;
+    uint64_t data = create_event(fd, fd_state()).data.u64;
+    try {
+        if (interested) {
+            ring->accept_multishot(data, fd, SOCK_NONBLOCK);
+        } else {
+            // Listener is paused, so kernel shouldn't take descriptors for it
+            ring->cancel(data);
+        }
+    } catch (annotated_exception const &) {
+        defer(fd, slot);
+        return;
+    }
+    // Clients, that were accepted while listener was paused, are taken now
+    if (interested && !slot.accepted.empty()) {
+        schedule(fd, EPOLLIN);
+    }
+    slot.armed = interested;
+}
+
+void epoll_core::poll(int fd, handler_slot &slot) {
+    if (!slot.edge) {
+        slot.registered = slot.interest;
+    }
+    // Edge-triggered descriptor is polled by multishot request, level-triggered one by request
+    // that is armed again after every completion, so it reports events while descriptor is ready
+    stats.submissions++;
+    try {
+        ring->poll_add(create_event(fd, fd_state()).data.u64, fd, slot.registered, slot.edge);
+    } catch (annotated_exception const &) {
+        defer(fd, slot);
+        return;
+    }
+    slot.armed = true;
+}
+
+void epoll_core::defer(int fd, handler_slot &slot) {
+    slot.changed = true;
+    deferred.push_back(fd);
+}
+
+void epoll_core::cancel(uint64_t data, bool poll) {
+    stats.submissions++;
+    try {
+        if (poll) {
+            ring->poll_remove(data);
+        } else {
+            ring->cancel(data);
+        }
+    } catch (annotated_exception const &) {
+        // It's retried by cancel, which removes poll too
+        cancels.push_back(data);
+    }
+}
+
+int epoll_core::wait_events(bool block) {
+    stats.wait_calls++;
+    if (!ring) {
+        return epoll_wait(fd, events.get(), queue_size, block ? -1 : 0);
+    }
+    if (!ring->submit(block ? 1 : 0)) {
+        errno = EINTR;
+        return -1;
+    }
+    return take_completions();
+}
+
+int epoll_core::take_completions() {
+    int events_number = 0;
+    uring::completion c;
+    while (events_number < queue_size && ring->pop(c)) {
+        if (c.data & SEND_REQUEST) {
+            take_send(c);
+            continue;
+        }
+        int fd = (int) (uint32_t) c.data;
+        uint32_t generation = (uint32_t) (c.data >> 32);
+        if ((size_t) fd >= handlers.size()) {
+            continue;
+        }
+        handler_slot &slot = handlers[fd];
+        if (!slot.active || slot.generation != generation) {
+            continue;
+        }
+        if (slot.accepting) {
+            if (take_accept(fd, slot, c)) {
+                events[events_number].events = EPOLLIN;
+                events[events_number].data.u64 = c.data;
+                events_number++;
+            }
+            continue;
+        }
+        if (!(c.flags & IORING_CQE_F_MORE)) {
+            slot.armed = false;
+            if (!slot.changed) {
+                slot.changed = true;
+                changes.push_back(fd);
+            }
+        }
+        if (c.result < 0) {
+            continue;
+        }
+        events[events_number].events = (uint32_t) c.result;
+        events[events_number].data.u64 = c.data;
+        events_number++;
+    }
+    return events_number;
+}
+
+bool epoll_core::take_accept(int fd, handler_slot &slot, uring::completion const &c) {
+    if (c.result == -ECANCELED) {
+        // Accept was cancelled, when listener was paused
+        return false;
+    }
+    if (!(c.flags & IORING_CQE_F_MORE)) {
+        slot.armed = false;
+        if (c.result == -EINVAL) {
+            // Kernel doesn't support multishot accept, so listener is polled
+            slot.accepting = false;
+        }
+        if (!slot.changed) {
+            slot.changed = true;
+            changes.push_back(fd);
+        }
+        if (c.result == -EINVAL) {
+            return false;
+        }
+    }
+    if (c.result >= 0) {
+        stats.accepted++;
+    }
+    // Handler is called once for clients accepted in the round
+    slot.accepted.push_back(c.result);
+    return slot.accepted.size() == 1;
+}
+
+void epoll_core::take_send(uring::completion const &c) {
+    send_request &request = *reinterpret_cast<send_request *>(c.data & ~SEND_REQUEST);
+    int fd = (int) (uint32_t) request.data;
+    uint32_t generation = (uint32_t) (request.data >> 32);
+    handler_slot &slot = handlers[fd];
+    bool current = slot.active && slot.generation == generation;
+    bool failed = c.result <= 0 || (size_t) c.result < request.left;
+    if (current && c.result > 0 && failed) {
+        // Send was interrupted, so the rest is sent by the same request
+        size_t done = (size_t) c.result;
+        request.left -= done;
+        while (done >= request.message.msg_iov->iov_len) {
+            done -= request.message.msg_iov->iov_len;
+            request.message.msg_iov++;
+            request.message.msg_iovlen--;
+        }
+        request.message.msg_iov->iov_base = static_cast<char *>(request.message.msg_iov->iov_base) + done;
+        request.message.msg_iov->iov_len -= done;
+        stats.submissions++;
+        try {
+            ring->send_message(c.data, fd, &request.message, MSG_NOSIGNAL | MSG_WAITALL);
+            return;
+        } catch (annotated_exception const &) {
+            // The rest isn't sent, so send fails
+        }
+    }
+    sends.erase(request.self);
+    slot.sending--;
+    if (!current) {
+        return;
+    }
+    // Handler takes all completions at once, so it's called for the first one, or for failure
+    slot.completed++;
+    if (failed) {
+        schedule(fd, EPOLLERR | EPOLLHUP);
+    } else if (slot.completed == 1) {
+        schedule(fd, EPOLLERR);
+    }
+}
+
+void epoll_core::accept_multishot(const file_descriptor &fd) {
+    if (!ring) {
+        return;
+    }
+    handler_slot &slot = get_slot(fd.get());
+    if (slot.armed) {
+        cancel(create_event(fd.get(), fd_state()).data.u64, true);
+        slot.armed = false;
+    }
+    slot.accepting = true;
+    arm_accept(fd.get(), slot);
+}
+
+bool epoll_core::is_accepting(const file_descriptor &fd) const {
+    return (size_t) fd.get() < handlers.size() && handlers[fd.get()].accepting;
+}
+
+int epoll_core::take_accepted(const file_descriptor &fd) {
+    handler_slot &slot = get_slot(fd.get());
+    if (slot.accepted.empty()) {
+        return -EAGAIN;
+    }
+    int result = slot.accepted.front();
+    slot.accepted.pop_front();
+    return result;
+}
+
+bool epoll_core::can_submit_sends() const {
+    return ring != nullptr;
+}
+
+void epoll_core::submit_send(const file_descriptor &fd, iovec const *parts, int parts_number,
+                             std::shared_ptr<void> owner) {
+    handler_slot &slot = get_slot(fd.get());
+    sends.emplace_back();
+    send_request &request = sends.back();
+    request.self = std::prev(sends.end());
+    request.data = create_event(fd.get(), fd_state()).data.u64;
+    request.parts.assign(parts, parts + parts_number);
+    request.left = 0;
+    for (int i = 0; i < parts_number; i++) {
+        request.left += parts[i].iov_len;
+    }
+    request.owner = std::move(owner);
+    memset(&request.message, 0, sizeof request.message);
+    request.message.msg_iov = request.parts.data();
+    request.message.msg_iovlen = request.parts.size();
+
+    // Stream socket sends all bytes before completion, unless connection is broken
+    try {
+        ring->send_message(SEND_REQUEST | (uint64_t) &request, fd.get(), &request.message,
+                           MSG_NOSIGNAL | MSG_WAITALL);
+    } catch (annotated_exception const &) {
+        sends.pop_back();
+        throw;
+    }
+    slot.sending++;
+    stats.sends++;
+    stats.submissions++;
+}
+
+size_t epoll_core::take_sends(const file_descriptor &fd) {
+    handler_slot &slot = get_slot(fd.get());
+    size_t completed = slot.completed;
+    slot.completed = 0;
+    return completed;
 }
 
 void epoll_core::update_fd_handler(const file_descriptor &fd, epoll_core::handler_t handler) {
-    handlers.erase(fd.get());
-    handlers.insert({fd.get(), handler});
+    set_handler(get_slot(fd.get()), std::move(handler));
+}
+
+void epoll_core::dispatch(epoll_event const &event) {
+    int fd = (int) (uint32_t) event.data.u64;
+    uint32_t generation = (uint32_t) (event.data.u64 >> 32);
+    if ((size_t) fd >= handlers.size()) {
+        return;
+    }
+
+    handler_slot &slot = handlers[fd];
+    // Descriptor was closed (and maybe registered again) by one of previous handlers
+    if (!slot.active || slot.generation != generation || !slot.handler) {
+        return;
+    }
+
+    if (event.events & EPOLLRDHUP) {
+        slot.hangup = true;
+    }
+    // Errors are always passed, other events only if handler is interested in them
+    uint32_t events = event.events & (slot.interest | EPOLLERR | EPOLLHUP);
+    if (events == 0) {
+        return;
+    }
+
+    // Handler is called in place. If it changes or removes itself, change is applied after call
+    slot.running = true;
+    budget_left = handler_budget;
+    try {
+        slot.handler(fd_state(events));
+    } catch (...) {
+        finish_call(slot);
+        throw;
+    }
+    finish_call(slot);
+
+    // Listener didn't take all accepted clients because of its budget
+    if (slot.accepting && !slot.accepted.empty() && slot.active && slot.generation == generation &&
+        (slot.interest & EPOLLIN)) {
+        stats.requeued++;
+        schedule(fd, EPOLLIN);
+        return;
+    }
+
+    // Edge won't be reported again, so descriptor, that may be still ready, waits in ready list
+    if (budget_left == 0 && slot.edge && slot.active && slot.generation == generation) {
+        uint32_t left = events & slot.interest;
+        if (left != 0) {
+            stats.requeued++;
+            schedule(fd, left);
+        }
+    }
+}
+
+void epoll_core::schedule(int fd, uint32_t events) {
+    epoll_event event = create_event(fd, fd_state(events));
+    ready.push_back(event);
+}
+
+void epoll_core::finish_call(handler_slot &slot) {
+    slot.running = false;
+    if (slot.replaced) {
+        slot.handler = std::move(slot.replacement);
+        slot.replacement = handler_t();
+        slot.replaced = false;
+    }
 }
 
 void epoll_core::start_wait() {
@@ -68,8 +542,38 @@ void epoll_core::start_wait() {
     started = true;
     stopped = false;
 
+    using clock = std::chrono::steady_clock;
+    clock::time_point busy_until;
+
+    std::vector<epoll_event> scheduled;
     while (!stopped) {
-        int events_number = epoll_wait(fd, events.get(), queue_size, -1);
+        apply_changes();
+        // Don't block, if some handlers are waiting in ready list or changes wait for io_uring, or events came
+        // recently in busy-poll mode
+        bool block = ready.empty() && deferred.empty();
+        bool spin = false;
+        clock::time_point wait_start;
+        if (busy_poll.count() != 0) {
+            wait_start = clock::now();
+            spin = block && wait_start < busy_until;
+            block = block && !spin;
+        }
+
+        int events_number = wait_events(block);
+
+        if (busy_poll.count() != 0) {
+            clock::time_point wait_end = clock::now();
+            size_t waited = (size_t) std::chrono::duration_cast<std::chrono::microseconds>(
+                    wait_end - wait_start).count();
+            if (block) {
+                stats.sleep_time += waited;
+            } else if (spin) {
+                stats.spin_time += waited;
+            }
+            if (events_number > 0 || !ready.empty()) {
+                busy_until = wait_end + busy_poll;
+            }
+        }
         if (events_number == -1) {
             int err = errno;
             if (err == EINTR) {
@@ -79,17 +583,18 @@ void epoll_core::start_wait() {
         }
 
         for (int i = 0; i < events_number; i++) {
-            int fd = events[i].data.fd;
-            uint32_t state = events[i].events;
-            handlers_t::iterator it = handlers.find(fd);
-            if (it != handlers.end()) {
-                handler_t handler = it->second;
-                handler(fd_state(state));
-            }
+            dispatch(events[i]);
             if (stopped) {
                 break;
             }
         }
+
+        // Handle scheduled events. Events, that are scheduled by these handlers, wait for the next round
+        scheduled.swap(ready);
+        for (auto it = scheduled.begin(); it != scheduled.end() && !stopped; it++) {
+            dispatch(*it);
+        }
+        scheduled.clear();
     }
     started = false;
 }
@@ -98,6 +603,32 @@ void epoll_core::stop_wait() {
     stopped = true;
 }
 
+void epoll_core::set_batch_updates(bool batch) {
+    if (!batch) {
+        apply_changes();
+    }
+    batch_updates = batch;
+}
+
+void epoll_core::set_busy_poll(size_t window) {
+    busy_poll = std::chrono::microseconds(window);
+}
+
+void epoll_core::set_handler_budget(size_t budget) {
+    handler_budget = std::max(budget, (size_t) 1);
+}
+
+bool epoll_core::spend(long bytes) {
+    if (bytes > 0) {
+        budget_left -= std::min((size_t) bytes, budget_left);
+    }
+    return budget_left > 0;
+}
+
+epoll_core::statistics const &epoll_core::get_statistics() const {
+    return stats;
+}
+
 void swap(epoll_core &first, epoll_core &second) {
     using std::swap;
     swap(first.fd, second.fd);
@@ -106,4 +637,15 @@ void swap(epoll_core &first, epoll_core &second) {
     swap(first.stopped, second.stopped);
     swap(first.events, second.events);
     swap(first.handlers, second.handlers);
+    swap(first.ready, second.ready);
+    swap(first.changes, second.changes);
+    swap(first.deferred, second.deferred);
+    swap(first.cancels, second.cancels);
+    swap(first.batch_updates, second.batch_updates);
+    swap(first.busy_poll, second.busy_poll);
+    swap(first.handler_budget, second.handler_budget);
+    swap(first.budget_left, second.budget_left);
+    swap(first.stats, second.stats);
+    swap(first.sends, second.sends);
+    swap(first.ring, second.ring);
 }
\ No newline at end of file
@@ -2,20 +2,44 @@
 #define PROXY_SERVER_EPOLL_WRAP_H
 
 #include <memory>
+#include <chrono>
 #include <sys/epoll.h>
-#include <map>
+#include <deque>
+#include <list>
+#include <vector>
+#include <functional>
 #include "../util/file_descriptor.h"
 #include "fd_state.h"
+#include "uring.h"
 
 struct epoll_core : file_descriptor {
     using handler_t = std::function<void(fd_state)>;
-    using handlers_t = std::map<int, handler_t>;
 
-    epoll_core(int max_queue_size);
+    // Kernel interface used for waiting: epoll, or io_uring with poll, accept and send requests
+    enum backend {
+        EPOLL, URING
+    };
+
+    struct statistics {
+        statistics();
+
+        size_t ctl_calls;   // Calls of epoll_ctl
+        size_t ctl_saved;   // Updates of events, that didn't need a call of epoll_ctl (or poll request)
+        size_t wait_calls;  // Calls of epoll_wait or io_uring_enter
+        size_t submissions; // Requests submitted to io_uring
+        size_t accepted;    // Descriptors accepted by multishot requests of io_uring
+        size_t sends;       // Sends submitted to io_uring
+        size_t requeued;    // Calls of handlers, that spent their budget and were moved to the next round
+        size_t spin_time;   // Microseconds spent in polls without waiting in busy-poll mode
+        size_t sleep_time;  // Microseconds spent in blocking waits in busy-poll mode
+    };
+
+    explicit epoll_core(int max_queue_size, backend type = EPOLL);
 
     epoll_core(epoll_core &&other);
 
-    // Register file descriptor in epoll
+    // Register file descriptor in epoll. If events contain fd_state::EDGE, descriptor is registered once in
+    // edge-triggered mode for all events, and following updates only change events passed to handler
     void register_fd(const file_descriptor &fd, fd_state events);
 
     void register_fd(const file_descriptor &fd, fd_state events, handler_t handler);
@@ -23,25 +47,150 @@ struct epoll_core : file_descriptor {
     // Unregister
     void unregister_fd(const file_descriptor &fd);
 
-    // Update state (and handler) of file descriptor
+    // Update state (and handler) of file descriptor. In batch mode new state is applied before next epoll_wait,
+    // so several updates of descriptor during one round cost one call of epoll_ctl (or none)
     void update_fd(const file_descriptor &fd, fd_state events);
 
     void update_fd_handler(const file_descriptor &fd, handler_t handler);
 
+    // Accept clients of registered listening socket by multishot request of io_uring instead of polling it.
+    // Accepted descriptors are queued, and handler is called with IN while there are some. Does nothing for epoll
+    void accept_multishot(const file_descriptor &fd);
+
+    // Does io_uring accept clients of listening socket. Listener falls back to polling on kernels before 5.19
+    bool is_accepting(const file_descriptor &fd) const;
+
+    // Take accepted non-blocking descriptor, or negated error number of accept (-EAGAIN, if there are no more)
+    int take_accepted(const file_descriptor &fd);
+
+    // Can sends be submitted to io_uring
+    bool can_submit_sends() const;
+
+    // Submit send of parts to io_uring. Sends of the round are submitted together with waiting, so they cost
+    // no system calls. Owner keeps memory of parts until completion. Handler is called with ERROR, when sends
+    // are completed, and with HUP too, when send has failed
+    void submit_send(const file_descriptor &fd, iovec const *parts, int parts_number, std::shared_ptr<void> owner);
+
+    // Number of sends of descriptor, that were completed since the previous call
+    size_t take_sends(const file_descriptor &fd);
+
     // Start epoll
     void start_wait();
 
     // Say epoll that it should stop
     void stop_wait();
 
+    void set_batch_updates(bool batch);
+
+    // Adaptive busy-poll: after events epoll is polled without waiting during window (in microseconds),
+    // and then it blocks until next event. 0 disables busy-poll
+    void set_busy_poll(size_t window);
+
+    // Set number of bytes, that one call of handler may transfer
+    void set_handler_budget(size_t budget);
+
+    // Take bytes from the budget of the running handler. Returns false, when budget is spent.
+    // Edge-triggered descriptor, whose handler spent its budget, is passed to handler again in the next round
+    bool spend(long bytes);
+
+    statistics const &get_statistics() const;
+
     friend void swap(epoll_core &first, epoll_core &second);
 
 private:
+    static const size_t DEFAULT_HANDLER_BUDGET = 64 * 1024;
+
+    // Handler of registered file descriptor. Handlers are stored in the table indexed by file descriptor
+    struct handler_slot {
+        handler_slot();
+
+        handler_t handler;
+        handler_t replacement;  // Handler, that was set while the current one was running
+        uint32_t generation;    // Changes on every registration of descriptor, so stale events are skipped
+        uint32_t interest;      // Events, that handler waits for
+        uint32_t registered;    // Events, that epoll waits for
+        bool active, running, replaced, changed;
+        bool armed;             // io_uring has poll (or accept) request for descriptor
+        bool edge, hangup;      // Edge-triggered registration and whether peer has closed its side
+        bool accepting;         // io_uring accepts clients of descriptor instead of polling it
+        std::deque<int> accepted;   // Descriptors accepted by io_uring, or negated errors of accept
+        size_t sending;         // Sends of descriptor, that aren't completed
+        size_t completed;       // Completed sends, that aren't taken by handler
+    };
+
+    // Send, that was submitted to io_uring. It's kept until completion, and its address is data of request
+    struct send_request {
+        uint64_t data;          // Descriptor and its generation, like in events
+        msghdr message;
+        std::vector<iovec> parts;
+        size_t left;            // Bytes, that aren't sent yet
+        std::shared_ptr<void> owner;
+        std::list<send_request>::iterator self;
+    };
+
+    // Slots are never moved, so handler can safely register new descriptors while it is running
+    using handlers_t = std::deque<handler_slot>;
+
     epoll_event create_event(int fd, fd_state const &events);
 
+    handler_slot &get_slot(int fd);
+
+    // Set handler, or postpone it until the end of the current call of handler
+    void set_handler(handler_slot &slot, handler_t handler);
+
+    void dispatch(epoll_event const &event);
+
+    // Pass events to handler in the next round without waiting for epoll
+    void schedule(int fd, uint32_t events);
+
+    void modify(int fd, handler_slot &slot);
+
+    // Poll descriptor by io_uring with registered events
+    void poll(int fd, handler_slot &slot);
+
+    // Wait for events (or get them without blocking) and save them to events
+    int wait_events(bool block);
+
+    // Convert completions of io_uring to events
+    int take_completions();
+
+    // Queue accepted descriptor. Returns, whether handler should be called
+    bool take_accept(int fd, handler_slot &slot, uring::completion const &c);
+
+    // Count completed send or submit its rest
+    void take_send(uring::completion const &c);
+
+    // Arm accept request of listener, which is interested in clients, or cancel it
+    void arm_accept(int fd, handler_slot &slot);
+
+    // Apply change of descriptor in the next round, because io_uring didn't take its request
+    void defer(int fd, handler_slot &slot);
+
+    // Remove poll (or cancel accept) of unregistered descriptor. It's retried in the next round, if io_uring
+    // didn't take it
+    void cancel(uint64_t data, bool poll);
+
+    // Apply updates of events, that were postponed in batch mode
+    void apply_changes();
+
+    // Apply handler, that was set during the call
+    void finish_call(handler_slot &slot);
+
     int queue_size;
     std::unique_ptr<epoll_event[]> events;
     handlers_t handlers;
+    std::vector<epoll_event> ready;
+    std::vector<int> changes;
+    std::vector<int> deferred;          // Changes, that io_uring didn't take
+    std::vector<uint64_t> cancels;      // Cancels, that io_uring didn't take
+    bool batch_updates;
+    std::chrono::microseconds busy_poll;
+    size_t handler_budget;
+    size_t budget_left;
+    statistics stats;
+    // Sends are destroyed after ring, which may still refer to their memory
+    std::list<send_request> sends;
+    std::unique_ptr<uring> ring;
     volatile bool started, stopped;
 };
 
@@ -1,33 +1,31 @@
 #include "epoll_elem.h"
 
-epoll_elem::epoll_elem() : epoll(0), fd(0) {}
+epoll_elem::epoll_elem() : epoll(0), fd(0), timeout(0) {}
 
 epoll_elem::epoll_elem(epoll_core &epoll, file_descriptor &&fd, fd_state state) :
-        epoll(&epoll), fd(std::move(fd)), events(state) {
+        epoll(&epoll), fd(std::move(fd)), events(state), timeout(0) {
 
     this->epoll->register_fd(this->fd, state);
 }
 
-epoll_elem::epoll_elem(epoll_core &epoll, file_descriptor &&fd, fd_state state, size_t timeout_in,
-                       size_t cur_ticks) :
-        epoll(&epoll), fd(std::move(fd)), events(state), timeout(timeout_in), expires_in(cur_ticks + timeout) {
+epoll_elem::epoll_elem(epoll_core &epoll, file_descriptor &&fd, fd_state state, size_t timeout_in) :
+        epoll(&epoll), fd(std::move(fd)), events(state), timeout(timeout_in) {
 
     this->epoll->register_fd(this->fd, state);
 }
 
 epoll_elem::epoll_elem(epoll_core &epoll, file_descriptor &&fd, fd_state state,
                        epoll_core::handler_t handler) :
-        epoll(&epoll), fd(std::move(fd)), events(state) {
+        epoll(&epoll), fd(std::move(fd)), events(state), timeout(0) {
 
     this->epoll->register_fd(this->fd, state, handler);
 }
 
 epoll_elem::epoll_elem(epoll_core &epoll, file_descriptor &&fd, fd_state state,
                        epoll_core::handler_t handler,
-                       size_t timeout_in, size_t cur_ticks) : epoll(&epoll), fd(std::move(fd)),
-                                                              events(state),
-                                                              timeout(timeout_in),
-                                                              expires_in(cur_ticks + timeout) {
+                       size_t timeout_in) : epoll(&epoll), fd(std::move(fd)),
+                                            events(state),
+                                            timeout(timeout_in) {
 
     this->epoll->register_fd(this->fd, state, handler);
 }
@@ -49,6 +47,9 @@ epoll_elem::~epoll_elem() {
 }
 
 void epoll_elem::update(fd_state state) {
+    if (events.is(fd_state::EDGE)) {
+        state = state | fd_state::EDGE;
+    }
     if (events != state) {
         events = state;
         epoll->update_fd(fd, state);
@@ -83,7 +84,6 @@ void swap(epoll_elem &first, epoll_elem &other) {
     swap(first.fd, other.fd);
     swap(first.events, other.events);
     swap(first.timeout, other.timeout);
-    swap(first.expires_in, other.expires_in);
 }
 
 std::string to_string(epoll_elem &er) {
@@ -94,3 +94,11 @@ fd_state epoll_elem::get_state() const {
     return events;
 }
 
+bool epoll_elem::is_edge_triggered() const {
+    return events.is(fd_state::EDGE);
+}
+
+bool epoll_elem::spend(long bytes) {
+    return epoll->spend(bytes) && is_edge_triggered();
+}
+
@@ -3,18 +3,19 @@
 
 
 #include "epoll_core.h"
+#include "timing_wheel.h"
 
 struct epoll_elem {
     epoll_elem();
 
     epoll_elem(epoll_core &epoll, file_descriptor &&fd, fd_state state);
 
-    epoll_elem(epoll_core &epoll, file_descriptor &&fd, fd_state state, size_t timeout, size_t cur_ticks);
+    epoll_elem(epoll_core &epoll, file_descriptor &&fd, fd_state state, size_t timeout);
 
     epoll_elem(epoll_core &epoll, file_descriptor &&fd, fd_state state, epoll_core::handler_t handler);
 
     epoll_elem(epoll_core &epoll, file_descriptor &&fd, fd_state state, epoll_core::handler_t handler,
-               size_t timeout, size_t cur_ticks);
+               size_t timeout);
 
     epoll_elem(epoll_elem &&other);
 
@@ -28,6 +29,15 @@ struct epoll_elem {
 
     fd_state get_state() const;
 
+    // Is descriptor registered in edge-triggered mode. Then handler should read or write until
+    // file_descriptor::WOULD_BLOCK, or remove event from state
+    bool is_edge_triggered() const;
+
+    // Take transferred bytes from the budget of the running handler. Returns, whether handler should
+    // continue transfer: level-triggered descriptor is reported by epoll again, so it's transferred once per call
+    bool spend(long bytes);
+
+    // Update state. Mode of registration (fd_state::EDGE) is kept
     void update(fd_state state);
 
     void update(epoll_core::handler_t handler);
@@ -46,7 +56,8 @@ struct epoll_elem {
     file_descriptor fd;
     fd_state events;
     size_t timeout;
-    size_t expires_in;
+    // Timer of registration in epoll_queue. It's bound to the place of registration, so it isn't moved with it
+    timing_wheel::timer timer;
 };
 
 
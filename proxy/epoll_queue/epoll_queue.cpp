@@ -9,7 +9,7 @@
 using sockets_t = std::map<int, epoll_elem>;
 using connections_t = std::list<connection>;
 
-epoll_queue::epoll_queue(int epoll_size) : epoll(epoll_size) {
+epoll_queue::epoll_queue(int epoll_size, epoll_core::backend backend) : epoll(epoll_size, backend) {
 
     signal_fd sig_fd({SIGINT, SIGPIPE}, {signal_fd::SIMPLE});
     epoll_elem signal_registration(epoll, std::move(sig_fd), fd_state::IN);
@@ -28,32 +28,15 @@ epoll_queue::epoll_queue(int epoll_size) : epoll(epoll_size) {
     });
 
     timer_fd timer(timer_fd::MONOTONIC, timer_fd::SIMPLE);
-    timer.set_interval(TICK_INTERVAL, TICK_INTERVAL);
+    timer.set_interval_ms(TICK_INTERVAL, TICK_INTERVAL);
     auto timer_handler = [this](fd_state state) {
         if (state.is(fd_state::IN)) {
             file_descriptor &timer_in = this->timer->second.get_fd();
             uint64_t ticked = 0;
             timer_in.read(&ticked, sizeof ticked);
 
-            ticks += ticked * TICK_INTERVAL;
-            for (auto it = sockets.begin(); it != sockets.end();) {
-                if (it->second.expires_in <= ticks) {
-                    log(it, "closed due timeout");
-                    it = sockets.erase(it);
-                } else {
-                    it++;
-                }
-            }
-
-            ticks += ticked;
-            for (auto it = connections.begin(); it != connections.end();) {
-                if (it->expires_in <= ticks) {
-                    log(it, "closed due timeout");
-                    it = connections.erase(it);
-                } else {
-                    it++;
-                }
-            }
+            // Only due buckets of wheel are handled
+            wheel.advance(ticked);
         }
     };
     this->timer = save_registration(epoll_elem(epoll, std::move(timer), fd_state::IN, timer_handler),
@@ -61,25 +44,30 @@ epoll_queue::epoll_queue(int epoll_size) : epoll(epoll_size) {
 }
 
 sockets_t::iterator epoll_queue::save_registration(epoll_elem registration, size_t timeout) {
-    registration.expires_in = ticks + timeout;
     registration.timeout = timeout;
     int fd = registration.get_fd().get();
-    return sockets.insert(std::make_pair(fd, epoll_elem(std::move(registration)))).first;
+    sockets_t::iterator it = sockets.insert(std::make_pair(fd, epoll_elem(std::move(registration)))).first;
+    arm(it);
+    return it;
 }
 
 
 sockets_t::iterator epoll_queue::save_registration(file_descriptor &&socket, fd_state state, size_t timeout) {
     int fd = socket.get();
-    return sockets.insert(
-            std::make_pair(fd, epoll_elem(epoll, std::move(socket), state, timeout, ticks))).first;
+    sockets_t::iterator it = sockets.insert(
+            std::make_pair(fd, epoll_elem(epoll, std::move(socket), state, timeout))).first;
+    arm(it);
+    return it;
 }
 
 sockets_t::iterator
 epoll_queue::save_registration(file_descriptor &&socket, fd_state state, size_t timeout,
                                epoll_core::handler_t handler) {
     int fd = socket.get();
-    return sockets.insert(
-            std::make_pair(fd, epoll_elem(epoll, std::move(socket), state, handler, timeout, ticks))).first;
+    sockets_t::iterator it = sockets.insert(
+            std::make_pair(fd, epoll_elem(epoll, std::move(socket), state, handler, timeout))).first;
+    arm(it);
+    return it;
 }
 
 void epoll_queue::close(sockets_t::iterator socket) {
@@ -87,7 +75,9 @@ void epoll_queue::close(sockets_t::iterator socket) {
 }
 
 connections_t::iterator epoll_queue::save_connection(connection conn) {
-    return connections.insert(connections.end(), std::move(conn));
+    connections_t::iterator it = connections.insert(connections.end(), std::move(conn));
+    arm(it);
+    return it;
 }
 
 void epoll_queue::close(connections_t::iterator connection) {
@@ -95,15 +85,43 @@ void epoll_queue::close(connections_t::iterator connection) {
 }
 
 void epoll_queue::set_active(sockets_t::iterator iterator) {
-    iterator->second.expires_in = ticks + iterator->second.timeout;
+    wheel.rearm(iterator->second.timer, to_ticks(iterator->second.timeout));
 }
 
 void epoll_queue::set_active(connections_t::iterator iterator) {
-    iterator->expires_in = ticks + iterator->timeout;
+    wheel.rearm(iterator->timer, to_ticks(iterator->timeout));
 }
 
 connection epoll_queue::make_connection(epoll_elem client, epoll_elem server, size_t timeout) {
-    return connection(std::move(client), std::move(server), timeout, ticks);
+    return connection(std::move(client), std::move(server), timeout);
+}
+
+void epoll_queue::run_after(timing_wheel::timer &timer, size_t timeout, timing_wheel::callback_t callback) {
+    wheel.arm(timer, to_ticks(timeout), std::move(callback));
+}
+
+size_t epoll_queue::to_ticks(size_t timeout) {
+    return (timeout + TICK_INTERVAL - 1) / TICK_INTERVAL;
+}
+
+void epoll_queue::arm(sockets_t::iterator socket) {
+    if (socket->second.timeout == INFINITE_TIMEOUT) {
+        return;
+    }
+    wheel.arm(socket->second.timer, to_ticks(socket->second.timeout), [this, socket]() {
+        log(socket, "closed due timeout");
+        sockets.erase(socket);
+    });
+}
+
+void epoll_queue::arm(connections_t::iterator connection) {
+    if (connection->timeout == INFINITE_TIMEOUT) {
+        return;
+    }
+    wheel.arm(connection->timer, to_ticks(connection->timeout), [this, connection]() {
+        log(connection, "closed due timeout");
+        connections.erase(connection);
+    });
 }
 
 std::string to_string(epoll_queue::sockets_t::iterator const &iterator) {
@@ -4,14 +4,14 @@
 #include "epoll_core.h"
 #include "connection.h"
 #include "epoll_elem.h"
+#include "timing_wheel.h"
 
+// Timeouts are in milliseconds
 static const int DEFAULT_QUEUE_SIZE = 200;
-static const size_t TICK_INTERVAL = 2;
-static const size_t SHORT_SOCKET_TIMEOUT = 60 * 4;
-static const size_t LONG_SOCKET_TIMEOUT = 60 * 20;
+static const size_t TICK_INTERVAL = 100;
+static const size_t SHORT_SOCKET_TIMEOUT = 1000 * 60 * 4;
+static const size_t LONG_SOCKET_TIMEOUT = 1000 * 60 * 20;
 static const size_t INFINITE_TIMEOUT = (size_t) 1 << (4 * sizeof(size_t));
-//static const size_t SHORT_SOCKET_TIMEOUT = (size_t) 1 << (4 * sizeof(size_t));
-//static const size_t LONG_SOCKET_TIMEOUT = (size_t) 1 << (4 * sizeof(size_t));
 
 struct epoll_queue {
 
@@ -20,14 +20,14 @@ struct epoll_queue {
 
 
     epoll_core epoll;
+    timing_wheel wheel;     // Timers of sockets and connections. It should be destroyed after them
     connections_t connections;
     sockets_t sockets;
     sockets_t::iterator timer;
-    size_t ticks = 0;
 
     epoll_queue() = delete;
 
-    epoll_queue(int size);
+    epoll_queue(int size, epoll_core::backend backend = epoll_core::EPOLL);
 
     sockets_t::iterator save_registration(epoll_elem registration, size_t timeout);
 
@@ -48,6 +48,16 @@ struct epoll_queue {
 
     void set_active(connections_t::iterator iterator);
 
+    // Call callback after timeout. Timer should live not longer than queue
+    void run_after(timing_wheel::timer &timer, size_t timeout, timing_wheel::callback_t callback);
+
+private:
+    // Convert timeout to ticks of timing wheel
+    static size_t to_ticks(size_t timeout);
+
+    void arm(sockets_t::iterator socket);
+
+    void arm(connections_t::iterator connection);
 };
 
 std::string to_string(epoll_queue::sockets_t::iterator const &iterator);
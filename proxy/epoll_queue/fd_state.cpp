@@ -69,6 +69,9 @@ uint32_t fd_state::value_of(std::initializer_list<state> st) {
             case RDHUP:
                 res |= EPOLLRDHUP;
                 break;
+            case EDGE:
+                res |= EPOLLET;
+                break;
             default:
                 res |= 0;
         }
@@ -7,8 +7,9 @@
 #include <sys/epoll.h>
 
 struct fd_state {
+    // EDGE is a mode of registration: descriptor is registered in edge-triggered mode
     enum state {
-        IN, OUT, WAIT, ERROR, HUP, RDHUP
+        IN, OUT, WAIT, ERROR, HUP, RDHUP, EDGE
     };
 
     fd_state();
@@ -18,10 +18,16 @@ timer_fd::timer_fd(clock_mode cmode, std::initializer_list<fd_mode> mode) {
 }
 
 void timer_fd::set_interval(long interval_sec, long start_after_sec) const {
+    set_interval_ms(interval_sec * 1000, start_after_sec * 1000);
+}
+
+void timer_fd::set_interval_ms(long interval_ms, long start_after_ms) const {
     itimerspec spec;
     memset(&spec, 0, sizeof spec);
-    spec.it_value.tv_sec = start_after_sec;
-    spec.it_interval.tv_sec = interval_sec;
+    spec.it_value.tv_sec = start_after_ms / 1000;
+    spec.it_value.tv_nsec = (start_after_ms % 1000) * 1000000;
+    spec.it_interval.tv_sec = interval_ms / 1000;
+    spec.it_interval.tv_nsec = (interval_ms % 1000) * 1000000;
     if (timerfd_settime(fd, 0, &spec, 0) == -1) {
         int err = errno;
         throw annotated_exception("timerfd", err);
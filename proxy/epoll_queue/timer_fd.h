@@ -21,6 +21,8 @@ struct timer_fd : file_descriptor {
     // Set interval for ticking
     void set_interval(long interval_sec, long start_after_sec) const;
 
+    void set_interval_ms(long interval_ms, long start_after_ms) const;
+
 private:
     int value_of(std::initializer_list<fd_mode> mode);
 };
@@ -0,0 +1,101 @@
+#include <algorithm>
+#include "timing_wheel.h"
+
+timing_wheel::timer::timer() : wheel(0), position() {}
+
+timing_wheel::timer::~timer() {
+    if (wheel != 0) {
+        wheel->cancel(*this);
+    }
+}
+
+bool timing_wheel::timer::is_armed() const {
+    return wheel != 0;
+}
+
+timing_wheel::timing_wheel() : current(0) {}
+
+void timing_wheel::arm(timer &t, size_t timeout, callback_t on_expire) {
+    cancel(t);
+    // Timer can't expire in the tick, that is handled now
+    size_t expires = current + std::max(timeout, (size_t) 1);
+    bucket_t &bucket = bucket_for(expires);
+    t.position = bucket.insert(bucket.end(), entry{expires, std::move(on_expire), &t, &bucket});
+    t.wheel = this;
+}
+
+void timing_wheel::rearm(timer &t, size_t timeout) {
+    if (t.wheel != this) {
+        return;
+    }
+    t.position->expires = current + std::max(timeout, (size_t) 1);
+    place(*t.position->bucket, t.position);
+}
+
+void timing_wheel::cancel(timer &t) {
+    if (t.wheel != this) {
+        return;
+    }
+    t.position->bucket->erase(t.position);
+    t.wheel = 0;
+}
+
+void timing_wheel::advance(size_t ticks) {
+    for (; ticks > 0; ticks--) {
+        current++;
+        if ((current & (LEVEL_SIZE - 1)) == 0) {
+            cascade(1);
+        }
+
+        bucket_t &due = buckets[0][current & (LEVEL_SIZE - 1)];
+        while (!due.empty()) {
+            // Callback can cancel or arm any timer, so entry is removed before call
+            callback_t on_expire = std::move(due.front().on_expire);
+            due.front().owner->wheel = 0;
+            due.pop_front();
+            on_expire();
+        }
+    }
+}
+
+size_t timing_wheel::now() const {
+    return current;
+}
+
+timing_wheel::bucket_t &timing_wheel::bucket_for(size_t expires) {
+    size_t delay = expires > current ? expires - current : 0;
+    if (delay > MAX_DELAY) {
+        // Timer will be placed again, when its bucket is cascaded
+        expires = current + MAX_DELAY;
+        delay = MAX_DELAY;
+    }
+    size_t level = 0;
+    while (level + 1 < LEVELS && delay >= ((size_t) 1 << (LEVEL_BITS * (level + 1)))) {
+        level++;
+    }
+    return buckets[level][(expires >> (LEVEL_BITS * level)) & (LEVEL_SIZE - 1)];
+}
+
+void timing_wheel::cascade(size_t level) {
+    if (level >= LEVELS) {
+        return;
+    }
+    size_t index = (current >> (LEVEL_BITS * level)) & (LEVEL_SIZE - 1);
+    if (index == 0) {
+        cascade(level + 1);
+    }
+
+    bucket_t moved;
+    moved.splice(moved.end(), buckets[level][index]);
+    while (!moved.empty()) {
+        place(moved, moved.begin());
+    }
+}
+
+void timing_wheel::place(bucket_t &from, bucket_t::iterator it) {
+    bucket_t &to = bucket_for(it->expires);
+    if (&to != &from) {
+        to.splice(to.end(), from, it);
+        it->bucket = &to;
+    }
+}
@@ -0,0 +1,86 @@
+#ifndef PROXY_SERVER_TIMING_WHEEL_H
+#define PROXY_SERVER_TIMING_WHEEL_H
+
+
+#include <cstddef>
+#include <functional>
+#include <list>
+
+// Hierarchical timing wheel. Time is measured in ticks. Arming, re-arming and cancelling of timer take O(1),
+// and advancing of time touches only buckets, that are due
+struct timing_wheel {
+    using callback_t = std::function<void()>;
+
+    struct timer;
+
+private:
+    struct entry;
+    using bucket_t = std::list<entry>;
+
+    struct entry {
+        size_t expires;
+        callback_t on_expire;
+        timer *owner;
+        bucket_t *bucket;
+    };
+
+public:
+    // Handle of timer. It's bound to its place in memory, so it can't be copied or moved.
+    // Timer is cancelled in destructor
+    struct timer {
+        timer();
+
+        timer(timer const &other) = delete;
+
+        timer &operator=(timer const &other) = delete;
+
+        ~timer();
+
+        bool is_armed() const;
+
+    private:
+        friend struct timing_wheel;
+
+        timing_wheel *wheel;
+        bucket_t::iterator position;
+    };
+
+    timing_wheel();
+
+    timing_wheel(timing_wheel const &other) = delete;
+
+    timing_wheel &operator=(timing_wheel const &other) = delete;
+
+    // Call on_expire, when timeout ticks pass. Timer is disarmed before call
+    void arm(timer &t, size_t timeout, callback_t on_expire);
+
+    // Move armed timer to timeout ticks from now
+    void rearm(timer &t, size_t timeout);
+
+    void cancel(timer &t);
+
+    // Move time forward and call callbacks of expired timers
+    void advance(size_t ticks);
+
+    size_t now() const;
+
+private:
+    static const size_t LEVEL_BITS = 6;
+    static const size_t LEVEL_SIZE = (size_t) 1 << LEVEL_BITS;
+    static const size_t LEVELS = 4;
+    static const size_t MAX_DELAY = ((size_t) 1 << (LEVEL_BITS * LEVELS)) - 1;
+
+    // Choose bucket for time of expiration
+    bucket_t &bucket_for(size_t expires);
+
+    // Move timers of the current bucket of level to lower levels
+    void cascade(size_t level);
+
+    void place(bucket_t &from, bucket_t::iterator it);
+
+    bucket_t buckets[LEVELS][LEVEL_SIZE];
+    size_t current;
+};
+
+
+#endif //PROXY_SERVER_TIMING_WHEEL_H
@@ -0,0 +1,212 @@
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include "uring.h"
+#include "../util/annotated_exception.h"
+
+uring::uring(unsigned entries) : file_descriptor(), backlog(), sq_ptr(MAP_FAILED), cq_ptr(MAP_FAILED), sq_size(0),
+                                 cq_size(0), sqes_size(0) {
+    io_uring_params params;
+    memset(&params, 0, sizeof params);
+    // Every registered descriptor can have a completion in one round
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = std::max(entries * 16, 4096u);
+
+    int ring = (int) syscall(__NR_io_uring_setup, entries, &params);
+    if (ring == -1) {
+        int err = errno;
+        throw annotated_exception("io_uring_setup", err);
+    }
+    fd = ring;
+
+    sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+        sq_size = cq_size = std::max(sq_size, cq_size);
+    }
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+    sq_ptr = mmap(0, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq_ptr != MAP_FAILED) {
+        cq_ptr = single_mmap ? sq_ptr : mmap(0, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                                             IORING_OFF_CQ_RING);
+    }
+    void *sqes_ptr = MAP_FAILED;
+    if (cq_ptr != MAP_FAILED) {
+        sqes_ptr = mmap(0, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    }
+    if (sqes_ptr == MAP_FAILED) {
+        int err = errno;
+        unmap();
+        throw annotated_exception("io_uring mmap", err);
+    }
+
+    char *sq = static_cast<char *>(sq_ptr);
+    sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    sq_mask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sq_entries = params.sq_entries;
+    sqe_tail = *sq_tail;
+    sqes = static_cast<io_uring_sqe *>(sqes_ptr);
+
+    char *cq = static_cast<char *>(cq_ptr);
+    cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cq_mask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+}
+
+uring::~uring() {
+    munmap(sqes, sqes_size);
+    unmap();
+}
+
+void uring::unmap() {
+    if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) {
+        munmap(cq_ptr, cq_size);
+    }
+    if (sq_ptr != MAP_FAILED) {
+        munmap(sq_ptr, sq_size);
+    }
+    sq_ptr = cq_ptr = MAP_FAILED;
+}
+
+io_uring_sqe *uring::get_sqe() {
+    for (int attempt = 0; sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries; attempt++) {
+        if (attempt == SUBMIT_ATTEMPTS) {
+            throw annotated_exception("io_uring", "submission queue is full");
+        }
+        // Queue is full, submit without waiting. Kernel doesn't take submissions, while completions overflow
+        int err = enter(0);
+        if (err == EBUSY || err == EAGAIN) {
+            reap();
+        } else if (err != 0 && err != EINTR) {
+            throw annotated_exception("io_uring_enter", err);
+        }
+    }
+    unsigned index = sqe_tail & sq_mask;
+    io_uring_sqe *sqe = &sqes[index];
+    memset(sqe, 0, sizeof(io_uring_sqe));
+    sq_array[index] = index;
+    sqe_tail++;
+    return sqe;
+}
+
+void uring::poll_add(uint64_t data, int fd, uint32_t events, bool multishot) {
+    io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->len = multishot ? IORING_POLL_ADD_MULTI : 0;
+    sqe->user_data = data;
+}
+
+void uring::poll_update(uint64_t data, uint32_t events) {
+    io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = data;
+    sqe->poll32_events = events;
+    sqe->len = IORING_POLL_UPDATE_EVENTS;
+    sqe->user_data = CONTROL_DATA;
+}
+
+void uring::poll_remove(uint64_t data) {
+    io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = data;
+    sqe->user_data = CONTROL_DATA;
+}
+
+void uring::accept_multishot(uint64_t data, int fd, int flags) {
+    io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->accept_flags = (uint32_t) flags;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = data;
+}
+
+void uring::send_message(uint64_t data, int fd, msghdr const *message, int flags) {
+    io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) message;
+    sqe->len = 1;
+    sqe->msg_flags = (uint32_t) flags;
+    sqe->user_data = data;
+}
+
+void uring::cancel(uint64_t data) {
+    io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = data;
+    sqe->user_data = CONTROL_DATA;
+}
+
+bool uring::submit(unsigned wait_for) {
+    // Reaped completions are ready already
+    int err = enter(backlog.empty() ? wait_for : 0);
+    if (err == EINTR) {
+        return false;
+    }
+    // Completion queue is overflowed, completions should be handled first. Requests stay in queue
+    if (err == EBUSY || err == EAGAIN) {
+        reap();
+        return true;
+    }
+    if (err != 0) {
+        throw annotated_exception("io_uring_enter", err);
+    }
+    return true;
+}
+
+int uring::enter(unsigned wait_for) {
+    __atomic_store_n(sq_tail, sqe_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    if (to_submit == 0 && wait_for == 0) {
+        return 0;
+    }
+
+    unsigned flags = wait_for > 0 ? IORING_ENTER_GETEVENTS : 0;
+    if (syscall(__NR_io_uring_enter, fd, to_submit, wait_for, flags, NULL, 0) == -1) {
+        return errno;
+    }
+    return 0;
+}
+
+void uring::reap() {
+    completion c;
+    while (take_cqe(c)) {
+        backlog.push_back(c);
+    }
+}
+
+bool uring::pop(completion &c) {
+    if (!backlog.empty()) {
+        c = backlog.front();
+        backlog.pop_front();
+        return true;
+    }
+    return take_cqe(c);
+}
+
+bool uring::take_cqe(completion &c) {
+    unsigned head = *cq_head;
+    while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+        io_uring_cqe const &cqe = cqes[head & cq_mask];
+        c.data = cqe.user_data;
+        c.result = cqe.res;
+        c.flags = cqe.flags;
+        head++;
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        if (c.data != CONTROL_DATA) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,83 @@
+#ifndef PROXY_SERVER_URING_H
+#define PROXY_SERVER_URING_H
+
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#include <cstdint>
+#include <deque>
+#include "../util/file_descriptor.h"
+
+// Minimal wrap of io_uring on raw syscalls. It's used by epoll_core for polling of descriptors, accepting and
+// sending: requests are collected in submission queue and are submitted by the same io_uring_enter, that waits
+// for completions. Full queue is submitted at once; if kernel still doesn't take it, the new request throws
+// annotated_exception and isn't queued
+struct uring : file_descriptor {
+    struct completion {
+        uint64_t data;
+        int32_t result;
+        uint32_t flags;
+    };
+
+    explicit uring(unsigned entries);
+
+    uring(uring const &other) = delete;
+
+    uring &operator=(uring const &other) = delete;
+
+    ~uring();
+
+    // Poll descriptor. Multishot poll stays armed, while its completions have IORING_CQE_F_MORE flag
+    void poll_add(uint64_t data, int fd, uint32_t events, bool multishot);
+
+    // Change events of poll, that is still armed
+    void poll_update(uint64_t data, uint32_t events);
+
+    void poll_remove(uint64_t data);
+
+    // Accept connections by multishot request. Every completion carries accepted descriptor. Needs Linux 5.19
+    void accept_multishot(uint64_t data, int fd, int flags);
+
+    // Send message. Message and its parts should stay unchanged until completion
+    void send_message(uint64_t data, int fd, msghdr const *message, int flags);
+
+    // Cancel accept or send
+    void cancel(uint64_t data);
+
+    // Submit requests and wait for at least wait_for completions. Returns false, if waiting was interrupted
+    bool submit(unsigned wait_for);
+
+    // Get next completion, if there is one
+    bool pop(completion &c);
+
+private:
+    // Data of requests, that change or cancel other ones. Their completions are skipped
+    static const uint64_t CONTROL_DATA = ~(uint64_t) 0;
+    // Submissions of full queue, after which request fails
+    static const int SUBMIT_ATTEMPTS = 4;
+
+    io_uring_sqe *get_sqe();
+
+    // Call io_uring_enter for queued requests. Returns errno, or 0 on success
+    int enter(unsigned wait_for);
+
+    // Move completions from completion queue to backlog, so kernel can flush overflowed ones and take submissions
+    void reap();
+
+    bool take_cqe(completion &c);
+
+    void unmap();
+
+    unsigned *sq_head, *sq_tail, *sq_array, sq_mask, sq_entries;
+    unsigned *cq_head, *cq_tail, cq_mask;
+    unsigned sqe_tail;
+    io_uring_sqe *sqes;
+    io_uring_cqe *cqes;
+    std::deque<completion> backlog;     // Reaped completions, that aren't popped yet
+
+    void *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size, sqes_size;
+};
+
+
+#endif //PROXY_SERVER_URING_H
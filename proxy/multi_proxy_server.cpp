@@ -0,0 +1,46 @@
+#include <sys/signalfd.h>
+#include <csignal>
+#include "multi_proxy_server.h"
+#include "util/signal_fd.h"
+
+
+multi_proxy_server::multi_proxy_server(proxy_options options) : reactors() {
+    options.reuse_port = true;
+    for (size_t i = 0; i < options.reactors; i++) {
+        reactors.push_back(std::unique_ptr<proxy_server>(new proxy_server(options)));
+    }
+}
+
+void multi_proxy_server::run() {
+    // Signals are blocked before starting of reactors, so only this thread receives them
+    signal_fd sig_fd({SIGINT, SIGPIPE}, {signal_fd::SIMPLE});
+
+    std::vector<thread_wrap> threads;
+    for (size_t i = 0; i < reactors.size(); i++) {
+        proxy_server *reactor = reactors[i].get();
+        threads.push_back(thread_wrap([reactor, i]() {
+            std::string tag = "reactor " + std::to_string(i);
+            try {
+                log(tag, "started");
+                reactor->serve();
+                log(tag, "stopped");
+            } catch (annotated_exception const &e) {
+                log(tag, e.what());
+            }
+        }));
+    }
+
+    while (true) {
+        struct signalfd_siginfo sinf;
+        long size = sig_fd.read(&sinf, sizeof(struct signalfd_siginfo));
+        if (size == sizeof(struct signalfd_siginfo) && sinf.ssi_signo == SIGINT) {
+            log("\nserver", "stopped");
+            break;
+        }
+    }
+
+    for (auto it = reactors.begin(); it != reactors.end(); it++) {
+        (*it)->stop();
+    }
+    // Threads are joined in destructors of thread_wrap
+}
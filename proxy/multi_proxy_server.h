@@ -0,0 +1,33 @@
+#ifndef PROXY_SERVER_MULTI_PROXY_SERVER_H
+#define PROXY_SERVER_MULTI_PROXY_SERVER_H
+
+#include <memory>
+#include <vector>
+
+#include "proxy_server.h"
+
+// Proxy server with several reactors. Every reactor is a proxy_server with its own epoll_queue, resolver and cache,
+// that runs in its own thread. Listeners of reactors are bound to the same port with SO_REUSEPORT, so kernel
+// distributes new clients between them
+struct multi_proxy_server {
+
+    multi_proxy_server() = delete;
+
+    // Start options.reactors reactors
+    explicit multi_proxy_server(proxy_options options);
+
+    multi_proxy_server(multi_proxy_server const &other) = delete;
+
+    multi_proxy_server &operator=(multi_proxy_server const &other) = delete;
+
+    // Start reactors and wait for SIGINT in current thread
+    void run();
+
+private:
+    using reactors_t = std::vector<std::unique_ptr<proxy_server>>;
+
+    reactors_t reactors;
+};
+
+
+#endif //PROXY_SERVER_MULTI_PROXY_SERVER_H
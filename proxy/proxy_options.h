@@ -0,0 +1,37 @@
+#ifndef PROXY_SERVER_PROXY_OPTIONS_H
+#define PROXY_SERVER_PROXY_OPTIONS_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "epoll_queue/epoll_core.h"
+
+// Options of proxy server, that are set at startup
+struct proxy_options {
+    uint16_t port = 8080;
+    int epoll_size = 200;           // Maximal number of events got from one epoll_wait
+    int queue_size = 200;           // Size of listener's queue
+    size_t accept_budget = 64;      // Maximal number of clients accepted per wakeup of listener
+
+    size_t reactors = 1;            // Number of reactors (threads with own epoll). 0 means one per CPU core
+    bool reuse_port = false;        // Bind listener with SO_REUSEPORT (set for every reactor in multi-reactor mode)
+
+    bool edge_triggered = false;    // Register clients and servers in edge-triggered mode
+    bool batch_updates = false;     // Apply changes of registrations once per round of epoll
+    size_t handler_budget = 64 * 1024;  // Maximal number of bytes transferred by one call of handler
+    size_t busy_poll = 0;           // Window of adaptive busy-poll in microseconds, 0 to always block
+    bool socket_busy_poll = false;  // Set SO_BUSY_POLL with the same window on clients and servers
+
+    bool splice_tunnel = true;      // Move data of CONNECT between sockets by splice through pipes
+    size_t tunnel_buffer = 8 * 1024;    // Size of ring buffer of CONNECT, when data is copied
+
+    size_t max_cached_body = 16 * 1024 * 1024;  // Longer responses are streamed to client and aren't cached
+    size_t high_watermark = 256 * 1024; // Unsent bytes of connection, when reading from its source stops
+    size_t low_watermark = 64 * 1024;   // Unsent bytes of connection, when reading is resumed
+    size_t zerocopy_threshold = 0;      // Writes of responses of this size and longer use MSG_ZEROCOPY. 0 disables it
+    epoll_core::backend backend = epoll_core::EPOLL;   // Kernel interface for waiting for events
+    bool submit_sends = true;       // With io_uring, writes are sent by requests, that are submitted with waiting
+};
+
+
+#endif //PROXY_SERVER_PROXY_OPTIONS_H
@@ -4,27 +4,26 @@
 #include "util/signal_fd.h"
 
 
-proxy_server::proxy_server(int epoll_size, uint16_t port, int queue_size) : queue(epoll_size), rt() {
+proxy_server::proxy_server(proxy_options const &options) : queue(options.epoll_size, options.backend), options(options), rt(),
+                                                             pipes(std::make_shared<pipe_pool>((size_t) MAX_POOLED_PIPES)) {
 
     socket_wrap listener(socket_wrap::NONBLOCK);
     event_fd notifier(0, event_fd::SEMAPHORE);
+    event_fd stopper(0, event_fd::SIMPLE);
 
-    listener.bind(port);
-    listener.listen(queue_size);
+    if (options.reuse_port) {
+        listener.reuse_port();
+    }
+    listener.bind(options.port);
+    listener.listen(options.queue_size);
+
+    queue.epoll.set_batch_updates(options.batch_updates);
+    queue.epoll.set_handler_budget(options.handler_budget);
+    queue.epoll.set_busy_poll(options.busy_poll);
 
     auto listener_handler = [this](fd_state state) {
         if (state.is(fd_state::IN)) {
-            socket_wrap &listener_in = *static_cast<socket_wrap *>(&this->listener->second.get_fd());
-            try {
-                socket_wrap client = listener_in.accept(socket_wrap::NONBLOCK);
-                log("new client accepted", client.get());
-                sockets_t::iterator it = this->queue.save_registration(std::move(client), fd_state::IN,
-                                                                       SHORT_SOCKET_TIMEOUT);
-                read(it->second, client_request(), it, first_request_read(it));
-            } catch (annotated_exception const &e) {
-                log("accept failed", e.what());
-                return;
-            }
+            accept_clients();
         }
     };
 
@@ -34,8 +33,6 @@ proxy_server::proxy_server(int epoll_size, uint16_t port, int queue_size) : queu
             file_descriptor &notifier_in = this->notifier->second.get_fd();
             notifier_in.read(&u, sizeof(uint64_t));
 
-            socket_wrap destination(socket_wrap::NONBLOCK);
-
             resolved_ip_t ip = this->rt.get_ip();
 
             on_resolve_t::iterator it = on_resolve.find({ip.get_extra().socket, ip.get_extra().host});
@@ -54,6 +51,21 @@ proxy_server::proxy_server(int epoll_size, uint16_t port, int queue_size) : queu
                 return;
             }
 
+            std::unique_ptr<socket_wrap> destination_ptr;
+            try {
+                destination_ptr.reset(new socket_wrap(socket_wrap::NONBLOCK));
+            } catch (annotated_exception const &e) {
+                log(e);
+                if (e.get_errno() == EMFILE || e.get_errno() == ENFILE) {
+                    pause_listener();
+                }
+                send_404(client);
+                on_resolve.erase(it);
+                return;
+            }
+            socket_wrap &destination = *destination_ptr;
+            set_socket_options(destination);
+
             try {
                 destination.connect(ip.get_ip());
             } catch (annotated_exception const &e) {
@@ -67,7 +79,8 @@ proxy_server::proxy_server(int epoll_size, uint16_t port, int queue_size) : queu
 
             connection conn = queue.make_connection(std::move(client->second),
                                                     epoll_elem(this->queue.epoll, std::move(destination),
-                                                               fd_state::OUT), SHORT_SOCKET_TIMEOUT);
+                                                               fd_state::OUT | socket_mode()),
+                                                    SHORT_SOCKET_TIMEOUT);
 
             this->queue.sockets.erase(client);
             log(conn, "ip for " + ip.get_extra().host + " resolved: " + to_string(ip.get_ip()));
@@ -93,18 +106,31 @@ proxy_server::proxy_server(int epoll_size, uint16_t port, int queue_size) : queu
         }
     };
 
+    auto stopper_handler = [this](fd_state state) {
+        if (state.is(fd_state::IN)) {
+            uint64_t u;
+            this->stopper->second.get_fd().read(&u, sizeof(uint64_t));
+            queue.epoll.stop_wait();
+        }
+    };
 
     this->notifier = queue.save_registration(std::move(notifier), fd_state::IN, INFINITE_TIMEOUT,
                                              notifier_handler);
+    this->stopper = queue.save_registration(std::move(stopper), fd_state::IN, INFINITE_TIMEOUT,
+                                            stopper_handler);
     this->listener = queue.save_registration(std::move(listener), fd_state::IN, INFINITE_TIMEOUT,
                                              listener_handler);
+    queue.epoll.accept_multishot(this->listener->second.get_fd());
+    if (options.zerocopy_threshold != 0) {
+        drain_retired();
+    }
 
 }
 
 
 proxy_server::action_with_request proxy_server::first_request_read(sockets_t::iterator client) {
     return [this, client](client_request rqst) {
-        std::string host = rqst.get_header().get_property("host");
+        std::string host = rqst.get_header().get_property(known_header::HOST);
         connect_to_server(client, host, handle_client_request(rqst));
     };
 }
@@ -129,13 +155,14 @@ void proxy_server::connect_to_server(sockets_t::iterator sock, std::string host,
 
 proxy_server::action_with_connection proxy_server::handle_client_request(client_request rqst) {
     return [this, rqst](connections_t::iterator conn) {
-        if (rqst.get_header().get_request_line().get_type() == request_line::GET) {
+        if (rqst.get_header().get_request_line().get_type() == request_line::GET && rqst.is_read()) {
 
             // If cached, validate
             if (is_cached(rqst.get_header())) {
                 log(conn, "found cached for " + to_url(rqst.get_header()) + ", validating...");
 
                 server_response cached = get_cached(rqst.get_header());
+                cached.set_zerocopy(options.zerocopy_threshold);
                 send_and_read(conn->get_server_registration(),
                               make_validate_request(rqst.get_header(), cached.get_header()),
                               conn, handle_validation_response(conn, rqst, cached));
@@ -144,7 +171,7 @@ proxy_server::action_with_connection proxy_server::handle_client_request(client_
         }
         if (rqst.get_header().get_request_line().get_type() == request_line::CONNECT) {
             server_response resp(response_header(response_line(200, "Connection Established")), "");
-            send(conn->get_client_registration(), resp, conn, handle_connect(conn));
+            send(conn->get_client_registration(), std::move(resp), conn, handle_connect(conn));
             return;
         }
         fast_transfer(conn, rqst);
@@ -160,10 +187,6 @@ proxy_server::action_with_response proxy_server::handle_validation_response(conn
         if (code == 200 || code == 304) {
             // Can send cached
             log(conn, "cache valid");
-            if (resp.get_header().has_property("connnection")) {
-                cached.get_header().set_property("connection", resp.get_header().get_property("connection"));
-            }
-
             send_server_response(conn, std::move(rqst), std::move(cached));
         } else {
             // Can't do it
@@ -172,8 +195,7 @@ proxy_server::action_with_response proxy_server::handle_validation_response(conn
             delete_cached(rqst.get_header());
 
             // Send data to server
-            if (resp.get_header().has_property("connection") &&
-                to_lower(resp.get_header().get_property("connection")).compare("close") == 0) {
+            if (resp.get_header().property_is(known_header::CONNECTION, "close")) {
                 // Re-connect if closed
                 log(conn, "server closed due to \"Connection = close\", reconnecting");
 
@@ -182,7 +204,7 @@ proxy_server::action_with_response proxy_server::handle_validation_response(conn
                 sockets_t::iterator it = queue.save_registration(std::move(client), LONG_SOCKET_TIMEOUT);
 
                 connect_to_server(it,
-                                  rqst.get_header().get_property("host"),
+                                  rqst.get_header().get_property(known_header::HOST),
                                   [this, rqst](connections_t::iterator conn_in) {
                                       fast_transfer(conn_in, rqst);
                                   });
@@ -194,8 +216,8 @@ proxy_server::action_with_response proxy_server::handle_validation_response(conn
 }
 
 
-proxy_server::action proxy_server::reuse_connection(connections_t::iterator conn, std::string old_host) {
-    return [this, conn, old_host]() {
+proxy_server::action proxy_server::reuse_connection(connections_t::iterator conn, client_request rqst) {
+    return [this, conn, rqst]() mutable {
         log(conn, "server response sent");
         log(conn, "kept alive");
 
@@ -207,27 +229,41 @@ proxy_server::action proxy_server::reuse_connection(connections_t::iterator conn
             }
         });
 
-        // Read client request
-        read<request_header>(conn->get_client_registration(), client_request(), conn,
-                             [this, conn, old_host](client_request rqst) {
+        std::string old_host = rqst.get_header().get_property(known_header::HOST);
+        action_with_request handle = [this, conn, old_host](client_request rqst) {
+            std::string host = rqst.get_header().get_property(known_header::HOST);
+            log(conn, "client reused: " + old_host + " -> " + host);
 
-                                 std::string host = rqst.get_header().get_property("host");
-                                 log(conn, "client reused: " + old_host + " -> " + host);
-
-                                 if (host.compare(old_host) == 0) {
-                                     // If host the same, handle request
-                                     handle_client_request(std::move(rqst))(conn);
-                                 } else {
-                                     // Otherwise, disconnect, connect and send
-                                     log(conn, "disconnect from " + old_host);
-                                     epoll_elem client = std::move(conn->get_client_registration());
-                                     queue.close(conn);
+            if (host.compare(old_host) == 0) {
+                // If host the same, handle request
+                handle_client_request(std::move(rqst))(conn);
+            } else {
+                // Otherwise, disconnect, connect and send
+                log(conn, "disconnect from " + old_host);
+                epoll_elem client = std::move(conn->get_client_registration());
+                queue.close(conn);
 
-                                     sockets_t::iterator it = queue.save_registration(std::move(client),
-                                                                                      LONG_SOCKET_TIMEOUT);
-                                     connect_to_server(it, host, handle_client_request(std::move(rqst)));
-                                 }
-                             });
+                sockets_t::iterator it = queue.save_registration(std::move(client), LONG_SOCKET_TIMEOUT);
+                connect_to_server(it, host, handle_client_request(std::move(rqst)));
+            }
+        };
+
+        // Pipelined requests are read with the previous one. The next request starts with its bytes, and
+        // responses are sent in order, because requests are handled one by one
+        client_request next;
+        try {
+            next = rqst.take_rest();
+        } catch (annotated_exception const &e) {
+            log(conn, e.what());
+            queue.close(conn);
+            return;
+        }
+        if (next.is_header_read()) {
+            log(conn, "pipelined request");
+            handle(std::move(next));
+        } else {
+            read<request_header>(conn->get_client_registration(), std::move(next), conn, handle, true);
+        }
 
     };
 }
@@ -235,23 +271,37 @@ proxy_server::action proxy_server::reuse_connection(connections_t::iterator conn
 proxy_server::action proxy_server::handle_connect(connections_t::iterator conn) {
     return [this, conn]() {
         log(conn, "CONNECT started");
-        std::shared_ptr<raw_message> client_message = std::make_shared<raw_message>();
-        std::shared_ptr<raw_message> server_message = std::make_shared<raw_message>();
-        conn->get_server_registration()
-                .update({fd_state::RDHUP, fd_state::IN, fd_state::OUT},
-                        make_connect_transfer_handler(conn->get_server_registration(), server_message,
-                                                      conn->get_client_registration(), client_message, conn));
-        conn->get_client_registration()
-                .update({fd_state::RDHUP, fd_state::IN, fd_state::OUT},
-                        make_connect_transfer_handler(conn->get_client_registration(), client_message,
-                                                      conn->get_server_registration(), server_message, conn));
+        if (options.splice_tunnel) {
+            try {
+                start_tunnel(conn, std::make_shared<spliced_message>(pipes), std::make_shared<spliced_message>(pipes));
+                return;
+            } catch (annotated_exception const &e) {
+                log(conn, std::string("splice is unavailable, data is copied: ") + e.what());
+            }
+        }
+        start_tunnel(conn, std::make_shared<raw_message>(options.tunnel_buffer),
+                     std::make_shared<raw_message>(options.tunnel_buffer));
     };
 }
 
+template<typename M>
+void proxy_server::start_tunnel(connections_t::iterator conn, std::shared_ptr<M> client_message,
+                                std::shared_ptr<M> server_message) {
+    conn->get_server_registration()
+            .update({fd_state::RDHUP, fd_state::IN, fd_state::OUT},
+                    make_connect_transfer_handler(conn->get_server_registration(), server_message,
+                                                  conn->get_client_registration(), client_message, conn));
+    conn->get_client_registration()
+            .update({fd_state::RDHUP, fd_state::IN, fd_state::OUT},
+                    make_connect_transfer_handler(conn->get_client_registration(), client_message,
+                                                  conn->get_server_registration(), server_message, conn));
+}
+
+template<typename M>
 epoll_core::handler_t proxy_server::make_connect_transfer_handler(epoll_elem &in,
-                                                                  std::shared_ptr<raw_message> in_message,
+                                                                  std::shared_ptr<M> in_message,
                                                                   epoll_elem &out,
-                                                                  std::shared_ptr<raw_message> out_message,
+                                                                  std::shared_ptr<M> out_message,
                                                                   std::list<connection>::iterator conn) {
 
     return [this, &in, in_message, &out, out_message, conn](fd_state state) {
@@ -263,31 +313,53 @@ epoll_core::handler_t proxy_server::make_connect_transfer_handler(epoll_elem &in
             return;
         }
 
-        if (state.is(fd_state::IN) && in_message->can_read()) {
+        if (state.is(fd_state::IN)) {
+            long read_length = 1;
             try {
-                in_message->read_from(in.get_fd());
+                // In edge-triggered mode read until there is no data, no place for it or budget is spent
+                while (read_length > 0 && in_message->can_read() && !over_high_watermark(in_message->pending())) {
+                    read_length = in_message->read_from(in.get_fd());
+                    if (!in.spend(read_length)) {
+                        break;
+                    }
+                }
             } catch (annotated_exception const &e) {
                 log(conn, e.what());
                 this->queue.close(conn);
+                return;
             }
-            if (!in_message->can_read()) {
+            if (read_length == 0) {
+                log(conn, "CONNECT stopped");
+                this->queue.close(conn);
+                return;
+            }
+            if (!in_message->can_read() || over_high_watermark(in_message->pending())) {
                 in.update(in.get_state() ^ fd_state::IN);
             }
-            if (in_message->can_write()) {
+            if (in_message->can_write() && !out.get_state().is(fd_state::OUT)) {
                 out.update(out.get_state() | fd_state::OUT);
             }
         }
-        if (state.is(fd_state::OUT) && out_message->can_write()) {
+        if (state.is(fd_state::OUT)) {
+            long write_length = 1;
             try {
-                out_message->write_to(in.get_fd());
+                while (write_length > 0 && out_message->can_write()) {
+                    write_length = out_message->write_to(in.get_fd());
+                    if (!in.spend(write_length)) {
+                        break;
+                    }
+                }
             } catch (annotated_exception const &e) {
                 log(conn, e.what());
                 this->queue.close(conn);
+                return;
             }
             if (!out_message->can_write()) {
                 in.update(in.get_state() ^ fd_state::OUT);
             }
-            if (out_message->can_read()) {
+            // Reading is resumed, when the most of buffer is free
+            if (!out.get_state().is(fd_state::IN) && out_message->can_read() &&
+                under_low_watermark(out_message->pending(), out_message->capacity())) {
                 out.update(out.get_state() | fd_state::IN);
             }
         }
@@ -374,10 +446,11 @@ typename proxy_server::sockets_t::iterator proxy_server::escape_client(connectio
 
 template<typename T, typename C>
 void proxy_server::read(epoll_elem &from, buffered_message<T> message, C iterator,
-                        action_with<buffered_message<T>> next) {
+                        action_with<buffered_message<T>> next, bool until_header) {
     std::shared_ptr<buffered_message<T>> s_message = std::make_shared<buffered_message<T>>(std::move(message));
+    s_message->set_submitter(make_submitter());
     from.update({fd_state::IN, fd_state::RDHUP},
-                [this, &from, s_message, iterator, next](fd_state state) {
+                [this, &from, s_message, iterator, next, until_header](fd_state state) {
                     file_descriptor const &fd = from.get_fd();
                     queue.set_active(iterator);
 
@@ -401,14 +474,27 @@ void proxy_server::read(epoll_elem &from, buffered_message<T> message, C iterato
                     }
 
                     if (state.is(fd_state::IN)) {
+                        long read_length = 1;
                         try {
-                            s_message->read_from(fd);
+                            // In edge-triggered mode read until there is no data or budget is spent
+                            while (read_length > 0 && s_message->can_read() &&
+                                   !(until_header && s_message->is_header_read())) {
+                                read_length = s_message->read_from(fd);
+                                if (!from.spend(read_length)) {
+                                    break;
+                                }
+                            }
                         } catch (annotated_exception const &e) {
                             log(iterator, e.what());
                             queue.close(iterator);
                             return;
                         }
-                        if (s_message->is_read()) {
+                        if (read_length == 0) {
+                            log(iterator, "disconnected");
+                            queue.close(iterator);
+                            return;
+                        }
+                        if (s_message->is_read() || (until_header && s_message->is_header_read())) {
                             from.update(fd_state::WAIT);
                             next(std::move(*s_message));
                         }
@@ -424,6 +510,7 @@ void proxy_server::send(epoll_elem &to, buffered_message<T> message,
               [this, &to, s_message, iterator, next](fd_state state) {
                   file_descriptor const &fd = to.get_fd();
                   queue.set_active(iterator);
+                  state = take_completions(state, fd, *s_message);
 
                   if (state.is(fd_state::RDHUP)) {
                       log(iterator, "disconnected");
@@ -439,22 +526,34 @@ void proxy_server::send(epoll_elem &to, buffered_message<T> message,
                       annotated_exception exception(to_string(iterator) + " send", code);
                       log(exception);
                       queue.close(iterator);
+                      return;
                   }
 
                   if (state.is(fd_state::OUT)) {
                       try {
-                          s_message->write_to(fd);
+                          // In edge-triggered mode write until socket's buffer is full or budget is spent
+                          long write_length = 1;
+                          while (write_length > 0 && s_message->can_write()) {
+                              write_length = s_message->write_to(fd);
+                              if (!to.spend(write_length)) {
+                                  break;
+                              }
+                          }
                       } catch (annotated_exception const &e) {
                           log(iterator, e.what());
                           queue.close(iterator);
                           return;
                       }
-
-                      if (s_message->is_written()) {
-                          to.update(fd_state::WAIT);
-                          next();
+                      if (!s_message->can_write() && !s_message->is_written()) {
+                          // Kernel still reads memory of zero-copy sends, so completions are waited without OUT
+                          to.update({fd_state::WAIT, fd_state::RDHUP});
                       }
                   }
+
+                  if (s_message->is_written()) {
+                      to.update(fd_state::WAIT);
+                      next();
+                  }
               });
 }
 
@@ -469,15 +568,14 @@ void proxy_server::send_and_read(epoll_elem &to, client_request rqst,
 
 void proxy_server::send_server_response(connections_t::iterator conn, client_request rqst, server_response resp) {
     log(conn, "server's response read");
-    bool closed = resp.get_header().has_property("connection") &&
-                  to_lower(resp.get_header().get_property("connection")).compare("close") == 0;
+    bool closed = resp.get_header().property_is(known_header::CONNECTION, "close");
 
     if (closed) {
         log(conn, "server closed due to \"Connection = close\" ");
         sockets_t::iterator it = escape_client(conn);
         this->queue.close(conn);
 
-        send(it->second, resp, it, [this, it]() {
+        send(it->second, std::move(resp), it, [this, it]() {
             log(it->second.get_fd(), "server response sent");
             log(it->second.get_fd(), "closed due to \"Connection = close\"");
             this->queue.close(it);
@@ -485,7 +583,7 @@ void proxy_server::send_server_response(connections_t::iterator conn, client_req
     } else {
         conn->get_server_registration().update(fd_state::WAIT);
         send(conn->get_client_registration(), std::move(resp), conn,
-             reuse_connection(conn, rqst.get_header().get_property("host")));
+             reuse_connection(conn, std::move(rqst)));
     }
 
 }
@@ -499,10 +597,132 @@ void proxy_server::send_404(sockets_t::iterator client) {
     });
 }
 
+void proxy_server::stream_request(connections_t::iterator conn, client_request rqst, action_with_request next) {
+    std::shared_ptr<client_request> s_rqst = std::make_shared<client_request>(std::move(rqst));
+    s_rqst->set_submitter(make_submitter());
+
+    if (s_rqst->can_read()) {
+        // Body is passed to server, as it arrives, so sent parts aren't kept
+        s_rqst->set_retain_limit(0);
+        conn->get_client_registration().update(
+                {fd_state::IN, fd_state::RDHUP}, [this, conn, s_rqst](fd_state state) {
+                    queue.set_active(conn);
+                    file_descriptor const &fd = conn->get_client();
+                    epoll_elem &client = conn->get_client_registration();
+
+                    if (state.is(fd_state::RDHUP)) {
+                        if (fd.can_read() == 0) {
+                            log(conn, "client dropped connection");
+                            this->queue.close(conn);
+                            return;
+                        }
+                    }
+
+                    if (state.is({fd_state::HUP, fd_state::ERROR})) {
+                        int code;
+                        socklen_t size = sizeof(code);
+                        socket_wrap const &sock = *static_cast<socket_wrap const *>(&fd);
+                        sock.get_option(SO_ERROR, &code, &size);
+                        annotated_exception exception(to_string(conn) + " read", code);
+                        log(exception);
+                        this->queue.close(conn);
+                        return;
+                    }
+
+                    if (state.is(fd_state::IN)) {
+                        long read_length = 1;
+                        try {
+                            while (read_length > 0 && s_rqst->can_read() && !over_high_watermark(s_rqst->pending())) {
+                                read_length = s_rqst->read_from(fd);
+                                if (!client.spend(read_length)) {
+                                    break;
+                                }
+                            }
+                        } catch (annotated_exception const &e) {
+                            log(conn, e.what());
+                            this->queue.close(conn);
+                            return;
+                        }
+                        if (read_length == 0 && !s_rqst->is_read()) {
+                            log(conn, "client dropped connection");
+                            this->queue.close(conn);
+                            return;
+                        }
+                        // Server is slower than client, or body is read
+                        if (!s_rqst->can_read() || over_high_watermark(s_rqst->pending())) {
+                            client.update(fd_state::WAIT);
+                        }
+                        epoll_elem &server = conn->get_server_registration();
+                        if (s_rqst->can_write() && !server.get_state().is(fd_state::OUT)) {
+                            server.update({fd_state::OUT, fd_state::RDHUP});
+                        }
+                    }
+                });
+    }
+
+    conn->get_server_registration().update(
+            {fd_state::OUT, fd_state::RDHUP}, [this, conn, s_rqst, next](fd_state state) {
+                queue.set_active(conn);
+                file_descriptor const &fd = conn->get_server();
+                epoll_elem &server = conn->get_server_registration();
+                state = take_completions(state, fd, *s_rqst);
+
+                if (state.is(fd_state::RDHUP)) {
+                    log(conn, "server dropped connection");
+                    this->queue.close(conn);
+                    return;
+                }
+
+                if (state.is({fd_state::HUP, fd_state::ERROR})) {
+                    int code;
+                    socklen_t size = sizeof(code);
+                    socket_wrap const &sock = *static_cast<socket_wrap const *>(&fd);
+                    sock.get_option(SO_ERROR, &code, &size);
+                    annotated_exception exception(to_string(conn) + " send", code);
+                    log(exception);
+                    this->queue.close(conn);
+                    return;
+                }
+
+                if (state.is(fd_state::OUT)) {
+                    try {
+                        long write_length = 1;
+                        while (write_length > 0 && s_rqst->can_write()) {
+                            write_length = s_rqst->write_to(fd);
+                            if (!server.spend(write_length)) {
+                                break;
+                            }
+                        }
+                    } catch (annotated_exception const &e) {
+                        log(conn, e.what());
+                        this->queue.close(conn);
+                        return;
+                    }
+                    if (!s_rqst->can_write() && !s_rqst->is_written()) {
+                        // The rest of body isn't read yet
+                        server.update({fd_state::WAIT, fd_state::RDHUP});
+                    }
+                    epoll_elem &client = conn->get_client_registration();
+                    if (!client.get_state().is(fd_state::IN) && s_rqst->can_read() &&
+                        under_low_watermark(s_rqst->pending())) {
+                        client.update({fd_state::IN, fd_state::RDHUP});
+                    }
+                }
+
+                if (s_rqst->is_written()) {
+                    server.update(fd_state::WAIT);
+                    next(std::move(*s_rqst));
+                }
+            });
+}
+
 void proxy_server::fast_transfer(connections_t::iterator conn, client_request rqst) {
-    send(conn->get_server_registration(), rqst, conn, [this, conn, rqst]() {
+    stream_request(conn, std::move(rqst), [this, conn](client_request rqst) {
         std::shared_ptr<client_request> s_rqst = std::make_shared<client_request>(std::move(rqst));
         std::shared_ptr<server_response> resp = std::make_shared<server_response>(server_response());
+        resp->set_retain_limit(options.max_cached_body);
+        resp->set_zerocopy(options.zerocopy_threshold);
+        resp->set_submitter(make_submitter());
 
         conn->get_server_registration().update(
                 {fd_state::IN, fd_state::RDHUP}, [this, conn, s_rqst, resp](fd_state state) {
@@ -525,24 +745,45 @@ void proxy_server::fast_transfer(connections_t::iterator conn, client_request rq
                         annotated_exception exception(to_string(conn) + " send", code);
                         log(exception);
                         this->queue.close(conn);
+                        return;
                     }
 
                     if (state.is(fd_state::IN)) {
+                        long read_length = 1;
+                        bool header_was_read = resp->is_header_read();
                         try {
-                            resp->read_from(server);
+                            while (read_length > 0 && resp->can_read() && !over_high_watermark(resp->pending())) {
+                                read_length = resp->read_from(server);
+                                if (!conn->get_server_registration().spend(read_length)) {
+                                    break;
+                                }
+                            }
                         } catch (annotated_exception const &e) {
                             log(conn, e.what());
                             this->queue.close(conn);
                             return;
                         }
+                        if (read_length == 0 && !resp->is_read()) {
+                            log(conn, "server dropped connection");
+                            this->queue.close(conn);
+                            return;
+                        }
+                        // Response, that won't be cached, is only passed to client
+                        if (!header_was_read && resp->is_header_read() && !should_cache(resp->get_header())) {
+                            resp->set_retain_limit(0);
+                        }
 
                         if (resp->can_write()) {
                             conn->get_client_registration().update({fd_state::OUT, fd_state::RDHUP});
                         }
+                        // Client is slower than server. Events of server (RDHUP too) wait, until client gets data
+                        if (!resp->is_read() && over_high_watermark(resp->pending())) {
+                            conn->get_server_registration().update(fd_state::WAIT);
+                        }
 
                         if (resp->is_read()) {
                             std::string url = to_url(s_rqst->get_header());
-                            if (should_cache(resp->get_header())) {
+                            if (!resp->is_streaming() && should_cache(resp->get_header())) {
                                 save_cached(url, resp->get_cache());
                                 log(conn, "response from " + url + " saved to cache");
                             }
@@ -555,6 +796,7 @@ void proxy_server::fast_transfer(connections_t::iterator conn, client_request rq
                 {fd_state::WAIT, fd_state::RDHUP}, [this, conn, s_rqst, resp](fd_state state) {
                     file_descriptor const &fd = conn->get_client();
                     queue.set_active(conn);
+                    state = take_completions(state, fd, *resp);
 
                     if (state.is(fd_state::RDHUP)) {
                         log(conn, "client dropped connection");
@@ -570,17 +812,30 @@ void proxy_server::fast_transfer(connections_t::iterator conn, client_request rq
                         annotated_exception exception(to_string(conn) + " send", code);
                         log(exception);
                         this->queue.close(conn);
+                        return;
                     }
 
                     if (state.is(fd_state::OUT) && resp->can_write()) {
                         try {
-                            resp->write_to(fd);
+                            long write_length = 1;
+                            while (write_length > 0 && resp->can_write()) {
+                                write_length = resp->write_to(fd);
+                                if (!conn->get_client_registration().spend(write_length)) {
+                                    break;
+                                }
+                            }
                         } catch (annotated_exception const &e) {
                             log(conn, e.what());
                             this->queue.close(conn);
                             return;
                         }
-                        if (!resp->can_write()) {
+                        epoll_elem &server = conn->get_server_registration();
+                        if (!server.get_state().is(fd_state::IN) && resp->can_read() &&
+                            under_low_watermark(resp->pending())) {
+                            server.update({fd_state::IN, fd_state::RDHUP});
+                        }
+                        // Write after completion of submitted send is called without OUT
+                        if (!resp->can_write() && conn->get_client_registration().get_state().is(fd_state::OUT)) {
                             conn->get_client_registration().update(
                                     conn->get_client_registration().get_state() ^ fd_state::OUT);
                         }
@@ -590,8 +845,123 @@ void proxy_server::fast_transfer(connections_t::iterator conn, client_request rq
 }
 
 
+void proxy_server::accept_clients() {
+    socket_wrap &listener_in = *static_cast<socket_wrap *>(&listener->second.get_fd());
+    bool accepting = queue.epoll.is_accepting(listener_in);
+    // Listener is level-triggered, so clients left after budget are accepted in the next round
+    for (size_t accepted = 0; accepted < options.accept_budget; accepted++) {
+        try {
+            // io_uring has accepted clients already
+            socket_wrap client = accepting ? socket_wrap::from_accept(queue.epoll.take_accepted(listener_in))
+                                           : listener_in.accept(socket_wrap::NONBLOCK);
+            log("new client accepted", client.get());
+            set_socket_options(client);
+            sockets_t::iterator it = queue.save_registration(std::move(client), fd_state::IN | socket_mode(),
+                                                             SHORT_SOCKET_TIMEOUT);
+            read(it->second, client_request(), it, first_request_read(it), true);
+        } catch (annotated_exception const &e) {
+            int err = e.get_errno();
+            if (err == EAGAIN || err == EWOULDBLOCK) {
+                return;
+            }
+            if (err == ECONNABORTED || err == EINTR) {
+                continue;
+            }
+            log("accept failed", e.what());
+            if (err == EMFILE || err == ENFILE) {
+                pause_listener();
+            }
+            return;
+        }
+    }
+}
+
+void proxy_server::pause_listener() {
+    // Pending client stays in queue of listener, so listener would be ready in every round until
+    // some descriptors are closed
+    log(listener, "paused for " + std::to_string(ACCEPT_PAUSE) + " ms");
+    listener->second.update(fd_state::WAIT);
+    queue.run_after(accept_paused, ACCEPT_PAUSE, [this]() {
+        log(listener, "resumed");
+        listener->second.update(fd_state::IN);
+    });
+}
+
+void proxy_server::drain_retired() {
+    drain_retired_sends();
+    queue.run_after(retired_drain, RETIRED_SENDS_CHECK, [this]() {
+        drain_retired();
+    });
+}
+
+bool proxy_server::over_high_watermark(size_t pending) const {
+    return pending >= options.high_watermark;
+}
+
+bool proxy_server::under_low_watermark(size_t pending, size_t capacity) const {
+    return pending <= std::min(options.low_watermark, capacity / 2);
+}
+
+template<typename T>
+fd_state proxy_server::take_completions(fd_state state, file_descriptor const &fd, buffered_message<T> &message) {
+    if (!state.is(fd_state::ERROR) || state.is(fd_state::HUP)) {
+        return state;
+    }
+    size_t sends = queue.epoll.take_sends(fd);
+    if (sends != 0) {
+        message.complete_sends(sends);
+        // Message waited for completion to write the rest
+        return message.can_write() ? (state ^ fd_state::ERROR) | fd_state::OUT : state ^ fd_state::ERROR;
+    }
+    try {
+        if (message.read_completions(fd)) {
+            return state ^ fd_state::ERROR;
+        }
+    } catch (annotated_exception const &e) {
+        log(e);
+    }
+    return state;
+}
+
+send_submitter proxy_server::make_submitter() {
+    if (!options.submit_sends || !queue.epoll.can_submit_sends()) {
+        return send_submitter();
+    }
+    return [this](file_descriptor const &socket, iovec const *parts, int parts_number, std::shared_ptr<void> owner) {
+        queue.epoll.submit_send(socket, parts, parts_number, std::move(owner));
+    };
+}
+
+void proxy_server::set_socket_options(socket_wrap const &socket) {
+    if (options.socket_busy_poll) {
+        try {
+            socket.busy_poll((unsigned) options.busy_poll);
+        } catch (annotated_exception const &e) {
+            // Usually it's lack of CAP_NET_ADMIN, so it would fail for every socket
+            log(e);
+            log("SO_BUSY_POLL", "disabled");
+            options.socket_busy_poll = false;
+        }
+    }
+    if (options.zerocopy_threshold != 0) {
+        try {
+            socket.zerocopy();
+        } catch (annotated_exception const &e) {
+            // Kernel doesn't support it, so it would fail for every socket
+            log(e);
+            log("SO_ZEROCOPY", "disabled");
+            options.zerocopy_threshold = 0;
+        }
+    }
+}
+
+fd_state proxy_server::socket_mode() const {
+    return options.edge_triggered ? fd_state::EDGE : fd_state::WAIT;
+}
+
 void proxy_server::save_cached(std::string url, cached_message const &response) {
-    cache.insert(std::move(url), response);
+    // Entry lives long, so it shouldn't pin receive slabs, that it fills only partly
+    cache.insert(std::move(url), response.compact());
 }
 
 bool proxy_server::is_cached(request_header const &request) const {
@@ -626,8 +996,52 @@ void proxy_server::run() {
             }
         }
     });
+    serve();
+}
+
+void proxy_server::serve() {
     queue.epoll.start_wait();
+    close_connections();
+
+    epoll_core::statistics const &stats = queue.epoll.get_statistics();
+    log("epoll", "epoll_ctl calls: " + std::to_string(stats.ctl_calls) +
+                 ", saved: " + std::to_string(stats.ctl_saved) +
+                 ", waits: " + std::to_string(stats.wait_calls) +
+                 ", io_uring submissions: " + std::to_string(stats.submissions) +
+                 ", accepted: " + std::to_string(stats.accepted) +
+                 ", sends: " + std::to_string(stats.sends) +
+                 ", requeued: " + std::to_string(stats.requeued));
+    buffer_statistics const &buffers = get_buffer_statistics();
+    double megabytes = std::max(buffers.received / 1048576.0, 1.0);
+    log("buffers", "received: " + std::to_string(buffers.received) +
+                   " bytes, slabs per MB: " + std::to_string((size_t) (buffers.slabs / megabytes)) +
+                   ", allocations per MB: " + std::to_string((size_t) (buffers.allocations / megabytes)) +
+                   ", bytes copied per MB: " + std::to_string((size_t) (buffers.copied / megabytes)) +
+                   ", writes: " + std::to_string(buffers.writes));
+    if (buffers.zerocopy_sends != 0) {
+        log("buffers", "zero-copy sends: " + std::to_string(buffers.zerocopy_sends) +
+                       ", copied by kernel: " + std::to_string(buffers.zerocopy_copied));
+    }
+    if (options.busy_poll != 0) {
+        log("epoll", "busy-poll spinning: " + std::to_string(stats.spin_time) +
+                     " us, sleeping: " + std::to_string(stats.sleep_time) + " us");
+    }
 }
 
+void proxy_server::close_connections() {
+    queue.connections.clear();
+    for (sockets_t::iterator it = queue.sockets.begin(); it != queue.sockets.end();) {
+        if (it == listener || it == notifier || it == stopper || it == queue.timer) {
+            it++;
+        } else {
+            it = queue.sockets.erase(it);
+        }
+    }
+    abort_retired_sends();
+}
 
+void proxy_server::stop() {
+    uint64_t u = 1;
+    stopper->second.get_fd().write(&u, sizeof(uint64_t));
+}
 
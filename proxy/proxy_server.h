@@ -6,8 +6,10 @@
 #include <memory>
 #include <list>
 
+#include "proxy_options.h"
 #include "request_processing/resolver.h"
 #include "request_processing/buffered_message.h"
+#include "request_processing/spliced_message.h"
 #include "request_processing/header_parser.h"
 #include "epoll_queue/epoll_elem.h"
 #include "epoll_queue/connection.h"
@@ -19,14 +21,24 @@ struct proxy_server {
 
     proxy_server() = delete;
 
-    proxy_server(int epoll_size, uint16_t port, int queue_size);
+    explicit proxy_server(proxy_options const &options);
 
+    // Handle SIGINT and start epoll
     void run();
 
+    // Start epoll without signal handling (signals are handled by the owner of server)
+    void serve();
+
+    // Say server that it should stop. Can be called from other threads
+    void stop();
+
     epoll_queue queue;
 
 private:
     static const size_t MAX_CACHE_SIZE = 20000;
+    static const size_t ACCEPT_PAUSE = 1000;    // In milliseconds
+    static const size_t RETIRED_SENDS_CHECK = 500;  // In milliseconds
+    static const size_t MAX_POOLED_PIPES = 64;
 
     // Types of used containers
     using cache_t = simple_cache<std::string, cached_message, MAX_CACHE_SIZE>;
@@ -50,9 +62,11 @@ private:
     // Connect to server and do "next"
     void connect_to_server(sockets_t::iterator sock, std::string host, action_with_connection next);
 
-    // Read message and do "next"
+    // Read message and do "next". Message is passed on after its header, when until_header is set (body is
+    // read later by stream_request)
     template<typename T, typename C>
-    void read(epoll_elem &from, buffered_message<T> message, C iterator, action_with<buffered_message<T>> next);
+    void read(epoll_elem &from, buffered_message<T> message, C iterator, action_with<buffered_message<T>> next,
+              bool until_header = false);
 
     // Send message and do "next"
     template<typename T, typename C>
@@ -62,6 +76,9 @@ private:
     template<typename C>
     void send_and_read(epoll_elem &to, client_request, C iterator, action_with_response next);
 
+    // Send request to server, while the rest of its body is read from client, and do "next"
+    void stream_request(connections_t::iterator conn, client_request rqst, action_with_request next);
+
     // Read response and send it to client during reading
     void fast_transfer(connections_t::iterator conn, client_request rqst);
 
@@ -79,8 +96,9 @@ private:
     // Connect to host from header
     action_with_request first_request_read(sockets_t::iterator client);
 
-    // If host differs from host, then connect. Otherwise, handle request
-    action reuse_connection(connections_t::iterator conn, std::string old_host);
+    // Handle the next request of client (pipelined one first). If its host differs from host of previous
+    // request, then connect. Otherwise, handle request
+    action reuse_connection(connections_t::iterator conn, client_request rqst);
 
     // Start validation or start transfer
     action_with_connection handle_client_request(client_request rqst);
@@ -95,12 +113,51 @@ private:
     // Connect to server
     epoll_core::handler_t make_server_connect_handler(connections_t::iterator conn, resolved_ip_t ip);
 
+    // Transfer data of CONNECT in both directions through messages (raw_message or spliced_message)
+    template<typename M>
+    void start_tunnel(connections_t::iterator conn, std::shared_ptr<M> client_message,
+                      std::shared_ptr<M> server_message);
+
+    template<typename M>
     epoll_core::handler_t make_connect_transfer_handler(epoll_elem &in,
-                                                        std::shared_ptr<raw_message> in_message,
+                                                        std::shared_ptr<M> in_message,
                                                         epoll_elem &out,
-                                                        std::shared_ptr<raw_message> out_message,
+                                                        std::shared_ptr<M> out_message,
                                                         connections_t::iterator conn);
 
+    // Accept clients until queue of listener is empty or budget is spent
+    void accept_clients();
+
+    // Stop accepting for ACCEPT_PAUSE, when process is out of descriptors
+    void pause_listener();
+
+    // Free zero-copy sends of closed connections, that are completed, every RETIRED_SENDS_CHECK
+    void drain_retired();
+
+    // Close connections and clients, so their messages are destroyed in the thread of reactor, and free
+    // their retired sends
+    void close_connections();
+
+    // Backpressure: reading stops, when unsent data reaches high watermark, and resumes, when it drops
+    // to low watermark (or to the half of capacity of buffer, that is smaller)
+    bool over_high_watermark(size_t pending) const;
+
+    bool under_low_watermark(size_t pending, size_t capacity = SIZE_MAX) const;
+
+    // Read completions of zero-copy or submitted sends of message. They are reported by EPOLLERR, so ERROR is
+    // removed from state, if it was only completions. OUT is added, if message can write the rest now
+    template<typename T>
+    fd_state take_completions(fd_state state, file_descriptor const &fd, buffered_message<T> &message);
+
+    // Submitter of writes to io_uring, or empty one, if writes are made by writev
+    send_submitter make_submitter();
+
+    // Set options from proxy_options on accepted or created socket
+    void set_socket_options(socket_wrap const &socket);
+
+    // Mode of registration of clients and servers: fd_state::EDGE or fd_state::WAIT (level-triggered)
+    fd_state socket_mode() const;
+
     // Caching
     client_request make_validate_request(request_header rqst, response_header response) const;
 
@@ -113,12 +170,18 @@ private:
     void delete_cached(request_header const &request);
 
 
+    proxy_options options;
     resolver_t rt;
     on_resolve_t on_resolve;
     cache_t cache;
+    std::shared_ptr<pipe_pool> pipes;   // Pipes of CONNECT tunnels. Messages, that are still alive, keep pool
 
     sockets_t::iterator listener;
     sockets_t::iterator notifier;
+    sockets_t::iterator stopper;
+
+    timing_wheel::timer accept_paused;
+    timing_wheel::timer retired_drain;
 };
 
 
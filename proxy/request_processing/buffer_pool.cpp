@@ -0,0 +1,76 @@
+#include "buffer_pool.h"
+#include "segment_chain.h"
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+namespace {
+    const size_t CLASSES = 3;
+    const size_t CLASS_SIZES[CLASSES] = {buffer_pool::SMALL, buffer_pool::MEDIUM, buffer_pool::LARGE};
+
+    // Memory of all arenas. It's freed at exit, when no thread uses blocks
+    struct arenas {
+        char *allocate() {
+            std::lock_guard<std::mutex> lock(mutex);
+            memory.emplace_back(new char[buffer_pool::ARENA_SIZE]);
+            return memory.back().get();
+        }
+
+        std::mutex mutex;
+        std::vector<std::unique_ptr<char[]>> memory;
+    };
+
+    arenas &get_arenas() {
+        static arenas instance;
+        return instance;
+    }
+
+    std::vector<char *> &free_list(size_t size_class) {
+        static thread_local std::vector<char *> lists[CLASSES];
+        return lists[size_class];
+    }
+
+    size_t class_of(size_t size) {
+        size_t size_class = 0;
+        while (size_class < CLASSES && CLASS_SIZES[size_class] < size) {
+            size_class++;
+        }
+        return size_class;
+    }
+}
+
+size_t buffer_pool::block_size(size_t size) {
+    size_t size_class = class_of(size);
+    return size_class == CLASSES ? size : CLASS_SIZES[size_class];
+}
+
+char *buffer_pool::acquire(size_t size) {
+    size_t size_class = class_of(size);
+    if (size_class == CLASSES) {
+        get_buffer_statistics().allocations++;
+        return new char[size];
+    }
+
+    std::vector<char *> &blocks = free_list(size_class);
+    if (blocks.empty()) {
+        // Whole arena goes to this thread
+        get_buffer_statistics().allocations++;
+        char *arena = get_arenas().allocate();
+        for (size_t offset = ARENA_SIZE; offset >= CLASS_SIZES[size_class]; offset -= CLASS_SIZES[size_class]) {
+            blocks.push_back(arena + offset - CLASS_SIZES[size_class]);
+        }
+    }
+    char *block = blocks.back();
+    blocks.pop_back();
+    return block;
+}
+
+void buffer_pool::release(char *block, size_t size) {
+    size_t size_class = class_of(size);
+    if (size_class == CLASSES) {
+        delete[] block;
+        return;
+    }
+    free_list(size_class).push_back(block);
+}
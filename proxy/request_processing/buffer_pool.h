@@ -0,0 +1,27 @@
+#ifndef PROXY_SERVER_BUFFER_POOL_H
+#define PROXY_SERVER_BUFFER_POOL_H
+
+#include <cstddef>
+
+// Pool of blocks for buffers of messages. Blocks have fixed sizes (4, 16 and 64 KB) and are carved from arenas,
+// that live until the end of process. Freed block goes to free list of the thread, that frees it,
+// so taking and returning of block don't need locks. Bigger blocks are allocated directly
+struct buffer_pool {
+    static const size_t SMALL = 4 * 1024;
+    static const size_t MEDIUM = 16 * 1024;
+    static const size_t LARGE = 64 * 1024;
+
+    static const size_t ARENA_SIZE = 1024 * 1024;
+
+    // Size of block, that is given for requested size
+    static size_t block_size(size_t size);
+
+    // Take block of block_size(size) bytes
+    static char *acquire(size_t size);
+
+    // Return block, size is the size it was acquired with
+    static void release(char *block, size_t size);
+};
+
+
+#endif //PROXY_SERVER_BUFFER_POOL_H
@@ -1,14 +1,20 @@
+#include <chrono>
+#include <vector>
 #include "buffered_message.h"
 
-raw_message::raw_message() : read_length(0), write_length(0) {}
+raw_message::raw_message(size_t capacity) : buffer(new char[capacity]), size(capacity), start(0), length(0) {}
 
-raw_message::raw_message(raw_message const &other) : read_length(other.read_length), write_length(other.write_length) {
-    for (size_t i = 0; i < other.read_length; i++) {
-        buffer[i] = other.buffer[i];
+raw_message::raw_message(raw_message const &other) : buffer(new char[other.size]), size(other.size),
+                                                     start(0), length(0) {
+    iovec parts[2];
+    int parts_number = other.filled_parts(parts);
+    for (int i = 0; i < parts_number; i++) {
+        std::copy_n(static_cast<char *>(parts[i].iov_base), parts[i].iov_len, buffer.get() + length);
+        length += parts[i].iov_len;
     }
 }
 
-raw_message::raw_message(raw_message &&other) {
+raw_message::raw_message(raw_message &&other) : buffer(), size(0), start(0), length(0) {
     swap(*this, other);
 }
 
@@ -18,32 +24,133 @@ raw_message &raw_message::operator=(raw_message other) {
 }
 
 bool raw_message::can_read() const {
-    return read_length < BUFFER_LENGTH;
+    return length < size;
 }
 
 bool raw_message::can_write() const {
-    return write_length < read_length;
+    return length > 0;
 }
 
-void raw_message::read_from(file_descriptor const &fd) {
-    read_length += fd.read(buffer + read_length, BUFFER_LENGTH - read_length);
+size_t raw_message::pending() const {
+    return length;
 }
 
-void raw_message::write_to(file_descriptor const &fd) {
-    write_length += fd.write(buffer + write_length, read_length - write_length);
-    if (write_length == BUFFER_LENGTH) {
-        read_length = 0;
-        write_length = 0;
+size_t raw_message::capacity() const {
+    return size;
+}
+
+long raw_message::read_from(file_descriptor const &fd) {
+    iovec parts[2];
+    long read = fd.readv(parts, free_parts(parts));
+    if (read > 0) {
+        length += read;
+    }
+    return read;
+}
+
+long raw_message::write_to(file_descriptor const &fd) {
+    iovec parts[2];
+    long written = fd.writev(parts, filled_parts(parts));
+    if (written <= 0) {
+        return written;
+    }
+    length -= written;
+    // Empty buffer starts from the beginning, so the next reading isn't split
+    start = (length == 0) ? 0 : (start + written) % size;
+    return written;
+}
+
+int raw_message::free_parts(iovec *parts) const {
+    size_t end = start + length;
+    if (end >= size) {
+        parts[0] = {buffer.get() + end - size, size - length};
+        return 1;
+    }
+    parts[0] = {buffer.get() + end, size - end};
+    parts[1] = {buffer.get(), start};
+    return start == 0 ? 1 : 2;
+}
+
+int raw_message::filled_parts(iovec *parts) const {
+    size_t end = start + length;
+    if (end <= size) {
+        parts[0] = {buffer.get() + start, length};
+        return 1;
     }
+    parts[0] = {buffer.get() + start, size - start};
+    parts[1] = {buffer.get(), end - size};
+    return 2;
 }
 
 void swap(raw_message &first, raw_message &second) {
     using std::swap;
-    swap(first.read_length, second.read_length);
-    swap(first.write_length, second.write_length);
+    swap(first.buffer, second.buffer);
+    swap(first.size, second.size);
+    swap(first.start, second.start);
+    swap(first.length, second.length);
+}
+
+// Completion of zero-copy send comes, when data is acknowledged, so connection, that doesn't acknowledge it
+// during this time, is considered dead
+static const std::chrono::seconds RETIRED_SEND_TIMEOUT(60);
+
+struct retired_send {
+    // Socket is declared last, so it's closed (and reset) before slabs are freed
+    segment_chain slabs;
+    size_t sends;
+    std::chrono::steady_clock::time_point deadline;
+    std::shared_ptr<socket_wrap> socket;
+};
+
+static std::vector<retired_send> &get_retired_sends() {
+    static thread_local std::vector<retired_send> sends;
+    return sends;
+}
+
+void retire_sends(std::shared_ptr<socket_wrap> socket, size_t sends, segment_chain slabs) {
+    get_retired_sends().push_back(retired_send{std::move(slabs), sends,
+                                               std::chrono::steady_clock::now() + RETIRED_SEND_TIMEOUT,
+                                               std::move(socket)});
+}
 
-    for (size_t i = 0; i < (first.read_length > second.read_length) ? first.read_length : second.read_length; i++) {
-        swap(first.buffer[i], second.buffer[i]);
+size_t drain_retired_sends() {
+    std::vector<retired_send> &retired = get_retired_sends();
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < retired.size();) {
+        retired_send &send = retired[i];
+        bool failed = false;
+        try {
+            send.sends -= std::min(send.sends, send.socket->read_completions().sends);
+        } catch (annotated_exception const &) {
+            // Connection is broken, so it's reset below
+            failed = true;
+        }
+        if (send.sends != 0 && !failed && now < send.deadline) {
+            i++;
+            continue;
+        }
+        if (send.sends != 0) {
+            try {
+                send.socket->abort_on_close();
+            } catch (annotated_exception const &e) {
+                log(e);
+            }
+        }
+        std::swap(send, retired.back());
+        retired.pop_back();
     }
+    return retired.size();
 }
 
+void abort_retired_sends() {
+    std::vector<retired_send> &retired = get_retired_sends();
+    drain_retired_sends();
+    for (size_t i = 0; i < retired.size(); i++) {
+        try {
+            retired[i].socket->abort_on_close();
+        } catch (annotated_exception const &e) {
+            log(e);
+        }
+    }
+    retired.clear();
+}
@@ -3,14 +3,26 @@
 
 #include <string>
 #include <algorithm>
+#include <memory>
+#include <deque>
+#include <functional>
+#include <climits>
 
 #include "../util/file_descriptor.h"
+#include "../util/socket_wrap.h"
+#include "../util/byte_scan.h"
 #include "header_parser.h"
+#include "segment_chain.h"
+#include "buffer_pool.h"
+#include "chunked_parser.h"
 #include "../util/annotated_exception.h"
 
-// Struct for messages with unlimited length and without HTTP headers
+// Struct for messages with unlimited length and without HTTP headers. Data is kept in ring buffer,
+// so reading continues while the beginning of buffer is written
 struct raw_message {
-    raw_message();
+    static const size_t DEFAULT_CAPACITY = 8 * 1024;
+
+    explicit raw_message(size_t capacity = DEFAULT_CAPACITY);
 
     raw_message(raw_message const &other);
 
@@ -23,30 +35,56 @@ struct raw_message {
 
     bool can_write() const;
 
-    // Read or Write
-    void read_from(file_descriptor const &fd);
+    // Number of bytes, that are read and aren't written yet, and number of bytes, that buffer can hold
+    size_t pending() const;
+
+    size_t capacity() const;
 
-    void write_to(file_descriptor const &fd);
+    // Read or Write. Return number of transferred bytes (0 at the end of file) or file_descriptor::WOULD_BLOCK
+    long read_from(file_descriptor const &fd);
+
+    long write_to(file_descriptor const &fd);
 
     friend void swap(raw_message &first, raw_message &second);
 
 private:
-    static const size_t BUFFER_LENGTH = 8 * 1024;
+    // Free or filled part of buffer, that can be split by the end of buffer
+    int free_parts(iovec *parts) const;
+
+    int filled_parts(iovec *parts) const;
 
-    size_t read_length, write_length;
-    char buffer[BUFFER_LENGTH];
+    std::unique_ptr<char[]> buffer;
+    size_t size;
+    size_t start;   // Position of the first byte, that isn't written yet
+    size_t length;  // Number of bytes, that are read and aren't written yet
 };
 
-// Message, that is saved in cache of proxy server
-using cached_message = std::vector<std::string>;
+// Message, that is saved in cache of proxy server. The first part is header
+using cached_message = segment_chain;
+
+// Keep slabs of zero-copy sends of message, that is destroyed before their completion (connection is closed).
+// Descriptor of socket is kept too, so completions can be read
+void retire_sends(std::shared_ptr<socket_wrap> socket, size_t sends, segment_chain slabs);
+
+// Read completions of retired sends and free completed ones. Connection, whose sends aren't completed during
+// timeout, is reset, so kernel drops them. Returns number of sockets, that are still retired
+size_t drain_retired_sends();
+
+// Reset connections of all retired sends and free them. It's called by reactor, before its thread exits, so
+// slabs return to the pool of this thread while it's alive
+void abort_retired_sends();
+
+// Sends parts to socket asynchronously (by io_uring). Owner keeps memory of parts until send is completed
+using send_submitter = std::function<void(file_descriptor const &socket, iovec const *parts, int parts_number,
+                                          std::shared_ptr<void> owner)>;
 
-// Message with HTTP header and fixed size. It caches data that it contains
+// Message with HTTP header and fixed size. It caches data that it contains.
+// Data is read into slabs and isn't copied after that: cache of message refers to parts of slabs
 template<typename T>
 struct buffered_message {
-    using cache_t = std::vector<std::string>;
-
     static const size_t INF = (size_t) 1 << (sizeof(size_t) * 4);
     static const size_t BUFFER_LENGTH = 8 * 1024;   // Maximal length of request's header supported by web-browsers
+    static const int MAX_WRITE_PARTS = IOV_MAX;     // Maximal number of parts written by one call of writev
 
     buffered_message();
 
@@ -60,7 +98,8 @@ struct buffered_message {
 
     buffered_message &operator=(buffered_message other);
 
-    ~buffered_message() = default;
+    // Zero-copy sends, that aren't completed, are retired
+    ~buffered_message();
 
     bool is_header_read() const;
 
@@ -70,28 +109,86 @@ struct buffered_message {
 
     bool is_read() const;
 
+    // Message is written, when all bytes are written and all zero-copy (or submitted) sends are completed
     bool is_written() const;
 
-    void read_from(file_descriptor const &socket);
+    // Number of read bytes, that aren't written yet
+    size_t pending() const;
+
+    // Read or Write. Return number of transferred bytes (0 at the end of file) or file_descriptor::WOULD_BLOCK
+    long read_from(file_descriptor const &socket);
+
+    long write_to(file_descriptor const &socket);
+
+    // Keep written parts, while body isn't longer than limit. After that message is streamed: written parts
+    // are released, and message can't be saved to cache
+    void set_retain_limit(size_t limit);
+
+    bool is_streaming() const;
+
+    // Writes of at least threshold bytes are sent with MSG_ZEROCOPY (0 disables it). Socket should allow it
+    void set_zerocopy(size_t threshold);
+
+    // Read completions of zero-copy sends from error queue of socket. Returns, whether there were any
+    bool read_completions(file_descriptor const &socket);
 
-    void write_to(file_descriptor const &socket);
+    // Writes are passed to submitter instead of writev. Submitted bytes are written, but the next write waits
+    // until send is completed, so sends of message don't overlap. Zero-copy isn't used then
+    void set_submitter(send_submitter submitter);
+
+    // Complete the first sends, that are in flight
+    void complete_sends(size_t sends);
 
     // Get cache or cached header
     cached_message get_cache() const;
 
-    T get_header() const;
+    // Message, that starts with bytes read after the end of this one (pipelined request). They are parsed, so
+    // the next message can be read already
+    buffered_message take_rest();
+
+    T const &get_header() const;
 
     template<typename S>
     friend void swap(buffered_message<S> &first, buffered_message<S> &second);
 
 private:
+    // Find the end of header in read data. Returns position after empty line or 0
+    size_t find_header_end();
+
+    // Handle bytes [begin, begin + length) of input, that were read
+    void take_input(size_t begin, size_t length);
+
+    // Append header to cache: unchanged bytes stay in slab, only changed lines are copied
+    void take_header();
+
+    // Take read bytes of body. Returns number of bytes, that belong to message
+    size_t take_body(size_t offset, size_t length);
+
+    // Release written parts in streaming mode. Parts of zero-copy sends stay until completion
+    void release_written();
+
     size_t header_length, body_length, read;
-    size_t read_length, write_length;
     T header;
-    char buffer[BUFFER_LENGTH];
-
-    size_t cur_part;
-    std::vector<std::string> cache;
+    bool chunked;
+    chunked_parser chunks;
+
+    slab_ptr input;         // Slab, that is being filled by reading. Its bytes after input_length aren't shared
+    size_t input_length;
+    size_t scanned;         // Bytes of input, where the end of header isn't found
+    size_t rest;            // Bytes at the end of input after the end of message
+
+    segment_chain cache;
+    size_t cur_part, write_length;
+    size_t written;         // Written bytes of parts, that aren't released
+
+    size_t retain_limit;
+    bool streaming;
+
+    size_t zerocopy_threshold;
+    std::deque<size_t> in_flight;   // Positions of zero-copy sends, that aren't completed, from the first written byte
+    size_t sent;                    // Bytes written since the first byte (released ones too)
+    std::shared_ptr<socket_wrap> zerocopy_socket;   // Own descriptor of socket for completions of zero-copy sends
+    send_submitter submitter;
 };
 
 using client_request = buffered_message<request_header>;
@@ -99,58 +196,81 @@ using server_response = buffered_message<response_header>;
 
 template<typename T>
 buffered_message<T>::buffered_message() :
-        header_length(0), body_length(INF), read(0), read_length(0), write_length(0),
-        header(T()), cur_part(0), cache{} {
+        header_length(0), body_length(INF), read(0), header(T()), chunked(false), chunks(), input(), input_length(0), scanned(0),
+        rest(0), cache(), cur_part(0), write_length(0), written(0), retain_limit(INF), streaming(false),
+        zerocopy_threshold(0), in_flight(), sent(0), zerocopy_socket(), submitter() {
+}
+
+template<typename T>
+buffered_message<T>::~buffered_message() {
+    // Kernel still reads these parts, so they can't return to pool
+    if (!in_flight.empty() && zerocopy_socket) {
+        retire_sends(zerocopy_socket, in_flight.size(), cache);
+    }
 }
 
 template<typename T>
 buffered_message<T>::buffered_message(cached_message cache)
         : buffered_message() {
-    header = T(cache[0]); // Header saved in 0th part
-    this->cache = cache;
+    // Header is at the beginning of 0th part, when it wasn't changed. It's parsed in place
+    char const *data = cache[0].data();
+    if (byte_scan::find_header_end(data, data + cache[0].length) != nullptr) {
+        header = T(header_buffer(cache[0].owner, data), cache[0].length);
+    } else {
+        // Changed header is split to parts, so they are joined
+        std::string message;
+        for (size_t i = 0; i < cache.parts(); i++) {
+            message += cache.to_string(i);
+            if (byte_scan::find_header_end(message.data(), message.data() + message.size()) != nullptr) {
+                break;
+            }
+        }
+        header = T(message);
+    }
+    this->cache = std::move(cache);
 
     header_length = 0; // Header isn't important now
 
-    body_length = 0;
-    for (auto it = this->cache.begin(); it != this->cache.end(); it++) {
-        body_length += it->size();
-    }
-
+    body_length = this->cache.size();
     read = body_length;
-
-    read_length = 0;
-
-    cur_part = 0;
 }
 
 template<typename T>
-buffered_message<T>::buffered_message(T const &header, std::string const &body) : header(header),
-                                                                                  cur_part(0),
-                                                                                  cache{} {
+buffered_message<T>::buffered_message(T const &header, std::string const &body) : buffered_message() {
+    this->header = header;
     std::string message = to_string(header);
     header_length = message.length();
     body_length = body.length();
-
-    message += body;
-
     read = body_length;
 
-    read_length = header_length + body_length;
-
-    write_length = 0;
-    cache.push_back(message);
-    cur_part = 0;
+    cache.append(message + body);
 }
 
 template<typename T>
 buffered_message<T>::buffered_message(buffered_message<T> const &other) :
         header_length(other.header_length), body_length(other.body_length), read(other.read),
-        read_length(other.read_length), write_length(other.write_length), header(other.header),
-        cur_part(other.cur_part), cache(other.cache) {
+        header(other.header), chunked(other.chunked), chunks(other.chunks), input(), input_length(0), scanned(other.scanned), rest(other.rest), cache(other.cache),
+        cur_part(other.cur_part), write_length(other.write_length), written(other.written),
+        retain_limit(other.retain_limit), streaming(other.streaming),
+        zerocopy_threshold(other.zerocopy_threshold), in_flight(), sent(other.sent),
+        zerocopy_socket(), submitter(other.submitter) {
+    // Zero-copy sends in flight belong to the original, which reads their completions and retires them
+    // Free space of slab belongs to one message, so only unparsed header is taken by copy
+    if (other.input && !other.is_header_read()) {
+        input = make_slab(other.input->capacity());
+        std::copy_n(other.input->data(), other.input_length, input->data());
+        input_length = other.input_length;
+        get_buffer_statistics().copied += input_length;
+    }
+    // Message with rest is read, so slab isn't filled anymore and can be shared
+    if (other.rest != 0) {
+        input = other.input;
+        input_length = other.input_length;
+    }
 }
 
 template<typename T>
-buffered_message<T>::buffered_message(buffered_message<T> &&other) {
+buffered_message<T>::buffered_message(buffered_message<T> &&other) : buffered_message() {
     swap(*this, other);
 }
 
@@ -167,12 +287,26 @@ void swap(buffered_message<T> &first, buffered_message<T> &second) {
     swap(first.header_length, second.header_length);
     swap(first.body_length, second.body_length);
     swap(first.read, second.read);
-    swap(first.read_length, second.read_length);
-    swap(first.write_length, second.write_length);
     swap(first.header, second.header);
+    swap(first.chunked, second.chunked);
+    swap(first.chunks, second.chunks);
+
+    swap(first.input, second.input);
+    swap(first.input_length, second.input_length);
+    swap(first.scanned, second.scanned);
+    swap(first.rest, second.rest);
 
+    swap(first.cache, second.cache);
     swap(first.cur_part, second.cur_part);
-    first.cache.swap(second.cache);
+    swap(first.write_length, second.write_length);
+    swap(first.written, second.written);
+    swap(first.retain_limit, second.retain_limit);
+    swap(first.streaming, second.streaming);
+    swap(first.zerocopy_threshold, second.zerocopy_threshold);
+    swap(first.in_flight, second.in_flight);
+    swap(first.sent, second.sent);
+    swap(first.zerocopy_socket, second.zerocopy_socket);
+    swap(first.submitter, second.submitter);
 }
 
 template<typename T>
@@ -182,7 +316,7 @@ bool buffered_message<T>::can_read() const {
 
 template<typename T>
 bool buffered_message<T>::can_write() const {
-    return cur_part != cache.size() && write_length < cache[cur_part].length();
+    return written < cache.size() && !(submitter && !in_flight.empty());
 }
 
 template<typename T>
@@ -192,7 +326,12 @@ bool buffered_message<T>::is_read() const {
 
 template<typename T>
 bool buffered_message<T>::is_written() const {
-    return is_read() && cur_part == cache.size();
+    return is_read() && written == cache.size() && in_flight.empty();
+}
+
+template<typename T>
+size_t buffered_message<T>::pending() const {
+    return cache.size() - written;
 }
 
 template<typename T>
@@ -201,80 +340,268 @@ bool buffered_message<T>::is_header_read() const {
 }
 
 template<typename T>
-T buffered_message<T>::get_header() const {
+T const &buffered_message<T>::get_header() const {
     return header;
 }
 
 
 template<typename T>
-void buffered_message<T>::read_from(file_descriptor const &socket) {
-    size_t should_read =
-            (body_length - read > BUFFER_LENGTH - read_length) ? BUFFER_LENGTH - read_length : body_length - read;
+long buffered_message<T>::read_from(file_descriptor const &socket) {
+    if (!input || input_length == input->capacity()) {
+        if (input && !is_header_read()) {
+            // Header doesn't fit in the first slab
+            return 0;
+        }
+        // Slab is taken only for reading, so message, that waits for data, holds no buffer.
+        // The first slab should hold header, the next ones are as big as the rest of body (up to the largest block)
+        size_t size = is_header_read() ? std::min(body_length - read, (size_t) buffer_pool::LARGE) : BUFFER_LENGTH;
+        input = make_slab(size);
+        input_length = 0;
+    }
+    size_t should_read = input->capacity() - input_length;
+    if (is_header_read()) {
+        should_read = std::min(should_read, body_length - read);
+    }
 
-    long read_length_cur = socket.read(buffer + read_length, should_read);
+    long read_length_cur = socket.read(input->data() + input_length, should_read);
+    if (read_length_cur <= 0) {
+        return read_length_cur;
+    }
+    get_buffer_statistics().received += read_length_cur;
 
-    read_length += read_length_cur;
-    std::string message(buffer, read_length);
-    if (header_length == 0) {
-        size_t pos = message.find("\r\n\r\n");
-        if (pos == std::string::npos)
-            pos = message.find("\n\n");
+    take_input(input_length, (size_t) read_length_cur);
+    return read_length_cur;
+}
 
-        if (pos != std::string::npos) {
-            pos += 4; // Skip \r\n\r\n
-            std::string body = message.substr(pos);
-            size_t read_body_length = body.length();
-            header = T(message);
+template<typename T>
+void buffered_message<T>::take_input(size_t begin, size_t length) {
+    input_length += length;
+    if (!is_header_read()) {
+        size_t end = find_header_end();
+        if (end == 0) {
+            return;
+        }
+        // Header is parsed in place and refers to slab
+        header = T(header_buffer(input, input->data()), end);
 
-            // Modify header
+        take_header();
 
-            // And save#include "epoll_core.h"
+        if (header.has_property(known_header::CONTENT_LENGTH)) {
+            body_length = header.get_number(known_header::CONTENT_LENGTH);
+        } else {
+            if (header.property_is(known_header::TRANSFER_ENCODING, "chunked")) {
+                body_length = INF;
+                chunked = true;
+            } else {
+                // ???
+                body_length = 0;
+            }
+        }
 
-            message = to_string(header);
-            header_length = message.length();
+        read = take_body(end, input_length - end);
+        rest = input_length - end - read;
+    } else {
+        size_t taken = take_body(begin, length);
+        read += taken;
+        rest = length - taken;
+    }
 
-            message += body;
+    if (chunked && chunks.is_finished()) {
+        body_length = read;
+    }
+    if (read > retain_limit) {
+        streaming = true;
+    }
+}
 
-            if (header.has_property("content-length")) {
-                body_length = header.get_int("content-length");
-            } else {
-                if (header.get_property("transfer-encoding").compare("chunked") == 0) {
-                    body_length = INF;
-                } else {
-                    // ???
-                    body_length = 0;
-                }
-            }
+template<typename T>
+buffered_message<T> buffered_message<T>::take_rest() {
+    buffered_message<T> next;
+    if (rest == 0) {
+        return next;
+    }
+    // Rest is small (it's read with the end of message), so it's copied to own slab of the next message
+    next.input = make_slab(std::max(rest, (size_t) BUFFER_LENGTH));
+    std::copy_n(input->data() + input_length - rest, rest, next.input->data());
+    get_buffer_statistics().copied += rest;
+    next.take_input(0, rest);
+    rest = 0;
+    return next;
+}
 
-            read = read_body_length;
+template<typename T>
+void buffered_message<T>::take_header() {
+    // Consecutive changed lines make one part
+    std::string changed;
+    header.serialize([this, &changed](header_span span) {
+        cache.append(changed);
+        changed.clear();
+        cache.append(input, span.offset, span.length);
+    }, [&changed](std::string const &line) {
+        changed += line;
+    });
+    cache.append(changed);
+    header_length = cache.size();
+}
 
-            cache.push_back(message);
-            read_length = 0;
-            cur_part = 0;
-        }
+template<typename T>
+size_t buffered_message<T>::take_body(size_t offset, size_t length) {
+    if (chunked) {
+        length = chunks.consume(input->data() + offset, length);
     } else {
-        read += read_length_cur;
-        cache.push_back(message);
-        read_length = 0;
+        // Bytes after body belong to the next message
+        length = std::min(length, body_length - read);
     }
+    cache.append(input, offset, length);
+    return length;
+}
 
-    if (body_length == INF) {
-        if (message.length() >= 5 && message.substr(message.length() - 5).compare("0\r\n\r\n") == 0) {
-            body_length = read;
-        }
-    }
+template<typename T>
+size_t buffered_message<T>::find_header_end() {
+    char const *data = input->data();
+    // Empty line can begin in bytes, that were scanned before
+    size_t from = scanned > 3 ? scanned - 3 : 0;
+    char const *end = byte_scan::find_header_end(data + from, data + input_length);
+    scanned = input_length;
+    return end == nullptr ? 0 : end - data;
 }
 
 template<typename T>
-void buffered_message<T>::write_to(file_descriptor const &socket) {
-    long write_length_cur = socket.write(cache[cur_part].c_str() + write_length,
-                                         cache[cur_part].length() - write_length);
-    write_length += write_length_cur;
-    // Next part of cache
-    if (write_length == cache[cur_part].length()) {
+long buffered_message<T>::write_to(file_descriptor const &socket) {
+    if (!can_write()) {
+        return 0;
+    }
+    // Parts can grow while they are written, so the next part is taken only when it exists
+    while (write_length == cache[cur_part].length) {
+        cur_part++;
         write_length = 0;
+    }
+
+    // All pending parts (header and body) are written by one call
+    iovec parts[MAX_WRITE_PARTS];
+    int parts_number = 0;
+    size_t length = 0;
+    for (size_t i = cur_part; i < cache.parts() && parts_number < MAX_WRITE_PARTS; i++) {
+        size_t offset = (i == cur_part) ? write_length : 0;
+        parts[parts_number++] = {const_cast<char *>(cache[i].data() + offset), cache[i].length - offset};
+        length += cache[i].length - offset;
+    }
+    long write_length_cur = file_descriptor::WOULD_BLOCK;
+    bool zerocopy = !submitter && zerocopy_threshold != 0 && length >= zerocopy_threshold;
+    if (submitter) {
+        // Slabs of parts are kept by send, so closing of connection doesn't free memory, that kernel reads
+        std::shared_ptr<std::vector<slab_ptr>> owners = std::make_shared<std::vector<slab_ptr>>();
+        for (size_t i = cur_part; i < cur_part + parts_number; i++) {
+            if (owners->empty() || owners->back() != cache[i].owner) {
+                owners->push_back(cache[i].owner);
+            }
+        }
+        submitter(socket, parts, parts_number, owners);
+        write_length_cur = (long) length;
+    } else if (zerocopy) {
+        try {
+            if (!zerocopy_socket) {
+                // Connection can be closed before completion, and then sends are completed through this descriptor
+                zerocopy_socket = std::make_shared<socket_wrap>(
+                        static_cast<socket_wrap const &>(socket).duplicate());
+            }
+            write_length_cur = static_cast<socket_wrap const &>(socket).send_zerocopy(parts, parts_number);
+        } catch (annotated_exception const &e) {
+            // Kernel is out of memory for pinning pages (optmem_max), or process is out of descriptors,
+            // so data is copied this time
+            if (e.get_errno() != ENOBUFS && e.get_errno() != EMFILE && e.get_errno() != ENFILE) {
+                throw;
+            }
+            zerocopy = false;
+        }
+    }
+    if (!zerocopy && !submitter) {
+        write_length_cur = socket.writev(parts, parts_number);
+    }
+    get_buffer_statistics().writes++;
+    if (write_length_cur <= 0) {
+        return write_length_cur;
+    }
+    written += write_length_cur;
+    if (zerocopy) {
+        get_buffer_statistics().zerocopy_sends++;
+    }
+    if (zerocopy || submitter) {
+        in_flight.push_back(sent);
+    }
+    sent += write_length_cur;
+
+    // Partially written part stays current
+    size_t left = (size_t) write_length_cur;
+    while (left > cache[cur_part].length - write_length) {
+        left -= cache[cur_part].length - write_length;
         cur_part++;
+        write_length = 0;
+    }
+    write_length += left;
+
+    if (streaming) {
+        release_written();
+    }
+    return write_length_cur;
+}
+
+template<typename T>
+void buffered_message<T>::release_written() {
+    // The current part stays, because it can still grow. Parts from the first uncompleted send stay too
+    size_t confirmed = in_flight.empty() ? written : in_flight.front() - (sent - written);
+    size_t parts = 0;
+    for (size_t length = 0; parts < cur_part && length + cache[parts].length <= confirmed; parts++) {
+        length += cache[parts].length;
     }
+    written -= cache.release_front(parts);
+    cur_part -= parts;
+}
+
+template<typename T>
+void buffered_message<T>::set_retain_limit(size_t limit) {
+    retain_limit = limit;
+    if (read > retain_limit && !streaming) {
+        streaming = true;
+        release_written();
+    }
+}
+
+template<typename T>
+void buffered_message<T>::set_zerocopy(size_t threshold) {
+    zerocopy_threshold = threshold;
+}
+
+template<typename T>
+bool buffered_message<T>::read_completions(file_descriptor const &socket) {
+    zerocopy_completions completions = static_cast<socket_wrap const &>(socket).read_completions();
+    if (completions.copied != 0) {
+        // Kernel copies data to this socket anyway, so pinning of pages is a waste
+        get_buffer_statistics().zerocopy_copied += completions.copied;
+        zerocopy_threshold = 0;
+    }
+    complete_sends(completions.sends);
+    return completions.sends != 0;
+}
+
+template<typename T>
+void buffered_message<T>::set_submitter(send_submitter submitter) {
+    this->submitter = std::move(submitter);
+}
+
+template<typename T>
+void buffered_message<T>::complete_sends(size_t sends) {
+    for (size_t i = 0; i < sends && !in_flight.empty(); i++) {
+        in_flight.pop_front();
+    }
+    if (streaming) {
+        release_written();
+    }
+}
+
+template<typename T>
+bool buffered_message<T>::is_streaming() const {
+    return streaming;
 }
 
 template<typename T>
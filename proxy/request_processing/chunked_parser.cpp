@@ -0,0 +1,106 @@
+#include "chunked_parser.h"
+#include "../util/annotated_exception.h"
+#include <algorithm>
+
+
+namespace {
+    int hex_value(char c) {
+        if (c >= '0' && c <= '9') {
+            return c - '0';
+        }
+        if (c >= 'a' && c <= 'f') {
+            return c - 'a' + 10;
+        }
+        if (c >= 'A' && c <= 'F') {
+            return c - 'A' + 10;
+        }
+        return -1;
+    }
+
+    void expect(char c, char expected) {
+        if (c != expected) {
+            throw annotated_exception("chunked", "malformed chunked body");
+        }
+    }
+}
+
+chunked_parser::chunked_parser() : state(SIZE), chunk_left(0), digits(0) {}
+
+size_t chunked_parser::consume(char const *data, size_t length) {
+    size_t pos = 0;
+    while (pos < length && state != FINISHED) {
+        char c = data[pos];
+        switch (state) {
+            case SIZE: {
+                int value = hex_value(c);
+                if (value >= 0) {
+                    if (digits == sizeof(size_t) * 2 - 1) {
+                        throw annotated_exception("chunked", "chunk is too big");
+                    }
+                    chunk_left = chunk_left * 16 + value;
+                    digits++;
+                } else if (digits == 0) {
+                    throw annotated_exception("chunked", "chunk size expected");
+                } else if (c == ';' || c == ' ' || c == '\t') {
+                    state = EXTENSION;
+                } else {
+                    expect(c, '\r');
+                    state = SIZE_LF;
+                }
+                break;
+            }
+            case EXTENSION:
+                if (c == '\r') {
+                    state = SIZE_LF;
+                }
+                break;
+            case SIZE_LF:
+                expect(c, '\n');
+                digits = 0;
+                state = chunk_left == 0 ? TRAILER_START : DATA;
+                break;
+            case DATA: {
+                // Data is skipped at once
+                size_t skipped = std::min(chunk_left, length - pos);
+                chunk_left -= skipped;
+                pos += skipped;
+                if (chunk_left == 0) {
+                    state = DATA_CR;
+                }
+                continue;
+            }
+            case DATA_CR:
+                expect(c, '\r');
+                state = DATA_LF;
+                break;
+            case DATA_LF:
+                expect(c, '\n');
+                state = SIZE;
+                break;
+            case TRAILER_START:
+                state = (c == '\r') ? LAST_LF : TRAILER;
+                break;
+            case TRAILER:
+                if (c == '\r') {
+                    state = TRAILER_LF;
+                }
+                break;
+            case TRAILER_LF:
+                expect(c, '\n');
+                state = TRAILER_START;
+                break;
+            case LAST_LF:
+                expect(c, '\n');
+                state = FINISHED;
+                break;
+            case FINISHED:
+                break;
+        }
+        pos++;
+    }
+    return pos;
+}
+
+bool chunked_parser::is_finished() const {
+    return state == FINISHED;
+}
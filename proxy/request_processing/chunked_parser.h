@@ -0,0 +1,38 @@
+#ifndef PROXY_SERVER_CHUNKED_PARSER_H
+#define PROXY_SERVER_CHUNKED_PARSER_H
+
+#include <cstddef>
+
+// Incremental parser of body with "Transfer-Encoding: chunked". It gets body by parts, as they are read,
+// and keeps only its state between them, so it finds the end of body split between reads and after trailers
+struct chunked_parser {
+    chunked_parser();
+
+    // Parse next part of body. Returns number of bytes, that belong to body (less than length after the end).
+    // Throws annotated_exception, if body is malformed
+    size_t consume(char const *data, size_t length);
+
+    bool is_finished() const;
+
+private:
+    enum parse_state {
+        SIZE,           // Hexadecimal size of chunk
+        EXTENSION,      // Extension of chunk after ';'
+        SIZE_LF,
+        DATA,
+        DATA_CR,
+        DATA_LF,
+        TRAILER_START,  // Start of trailer line or of the final empty line
+        TRAILER,
+        TRAILER_LF,
+        LAST_LF,
+        FINISHED
+    };
+
+    parse_state state;
+    size_t chunk_left;  // Size of chunk, while it's parsed, or the rest of its data
+    size_t digits;
+};
+
+
+#endif //PROXY_SERVER_CHUNKED_PARSER_H
@@ -1,52 +1,284 @@
 #include "header_parser.h"
+#include <cctype>
+#include <cstring>
+#include <limits>
+#include "../util/annotated_exception.h"
+
+header_buffer make_header_buffer(std::string const &message) {
+    std::shared_ptr<std::string> copy = std::make_shared<std::string>(message);
+    return header_buffer(copy, copy->data());
+}
 
-// Property in header
-header_property::header_property() : name(""), value("") {}
+// Names of well-known headers by their ids
+struct known_name {
+    char const *name;
+    size_t length;
+};
+
+static constexpr known_name KNOWN_NAMES[known_header::COUNT] = {
+        {"host",              4},
+        {"connection",        10},
+        {"proxy-connection",  16},
+        {"content-length",    14},
+        {"transfer-encoding", 17},
+        {"cache-control",     13},
+        {"pragma",            6},
+        {"cache",             5},
+        {"etag",              4},
+        {"last-modified",     13},
+        {"if-none-match",     13},
+        {"if-modified-since", 17}
+};
+
+// Names are ASCII, so locale isn't needed
+static inline char lower_ascii(char c) {
+    return (c >= 'A' && c <= 'Z') ? (char) (c + 'a' - 'A') : c;
+}
+
+// Compare bytes with string in lower case
+static bool equal_lower(char const *data, char const *lower, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (lower_ascii(data[i]) != lower[i]) {
+            return false;
+        }
+    }
+    return true;
+}
 
-header_property::header_property(std::string const &property) {
-    size_t begin = 0;
-    size_t end = property.find(':', begin);
+known_header::id known_header::find(char const *name, size_t length) {
+    for (size_t i = 0; i < COUNT; i++) {
+        if (KNOWN_NAMES[i].length == length && equal_lower(name, KNOWN_NAMES[i].name, length)) {
+            return (id) i;
+        }
+    }
+    return UNKNOWN;
+}
 
-    name = to_lower(property.substr(begin, end - begin));
+// Well-known names by their first letter: bit i of mask is set for name with id i
+struct names_by_letter {
+    names_by_letter() : masks() {
+        for (size_t i = 0; i < known_header::COUNT; i++) {
+            masks[KNOWN_NAMES[i].name[0] - 'a'] |= 1u << i;
+        }
+    }
 
-    // Skip ": "
+    uint32_t masks[26];
+};
 
-    end++;
-    while (end < property.length() && property[end] == ' ') {
-        end++;
+known_header::id known_header::find_in_line(char const *line, size_t length) {
+    static names_by_letter const letters;
+    char first = lower_ascii(length == 0 ? ' ' : line[0]);
+    if (first < 'a' || first > 'z') {
+        return UNKNOWN;
+    }
+    for (uint32_t mask = letters.masks[first - 'a']; mask != 0; mask &= mask - 1) {
+        size_t i = (size_t) __builtin_ctz(mask);
+        size_t name_length = KNOWN_NAMES[i].length;
+        if (name_length < length && line[name_length] == ':' &&
+            equal_lower(line, KNOWN_NAMES[i].name, name_length)) {
+            return (id) i;
+        }
     }
-    begin = end;
+    return UNKNOWN;
+}
 
-    // Rest is the value
-    value = property.substr(begin, property.size() - begin);
+std::string known_header::name(id header) {
+    return std::string(KNOWN_NAMES[header].name, KNOWN_NAMES[header].length);
 }
 
-header_property::header_property(std::string const &name, std::string const &value) : name(name), value(value) {}
+uint32_t known_header::hash(char const *name, size_t length) {
+    // FNV-1a
+    uint32_t result = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        result = (result ^ (uint8_t) lower_ascii(name[i])) * 16777619u;
+    }
+    return result;
+}
 
-header_property::header_property(header_property const &other) : name(other.name), value(other.value) {}
+// Property in header
+header_property::header_property() : line{0, 0}, name_span{0, 0}, value_span{0, 0}, decoded(true), own_name(true),
+                                     own_value(true), name(""), value(""), id(known_header::UNKNOWN), hash(0) {}
+
+header_property::header_property(char const *buffer, size_t begin, size_t end) :
+        header_property() {
+    line = {begin, end - begin};
+    decoded = own_name = own_value = false;
+    id = known_header::find_in_line(buffer + begin, end - begin);
+}
+
+header_property::header_property(std::string const &name, std::string const &value) :
+        header_property() {
+    this->name = name;
+    this->value = value;
+    id = known_header::find(name.data(), name.size());
+    hash = (id == known_header::UNKNOWN) ? known_header::hash(name.data(), name.size()) : 0;
+}
+
+header_property::header_property(header_property const &other) :
+        line(other.line), name_span(other.name_span), value_span(other.value_span), decoded(other.decoded),
+        own_name(other.own_name), own_value(other.own_value), name(other.name), value(other.value), id(other.id),
+        hash(other.hash) {}
 
-header_property::header_property(header_property &&other) : name(std::move(other.name)),
-                                                            value(std::move(other.value)) {}
+header_property::header_property(header_property &&other) :
+        line(other.line), name_span(other.name_span), value_span(other.value_span), decoded(other.decoded),
+        own_name(other.own_name), own_value(other.own_value), name(std::move(other.name)),
+        value(std::move(other.value)), id(other.id), hash(other.hash) {}
+
+void header_property::decode(char const *buffer) const {
+    if (decoded) {
+        return;
+    }
+    size_t begin = line.offset;
+    size_t end = line.offset + line.length;
+    // Colon of well-known name was found by recognition
+    size_t name_end = (id != known_header::UNKNOWN)
+                      ? begin + KNOWN_NAMES[id].length
+                      : byte_scan::find(buffer + begin, buffer + end, ':') - buffer;
+    name_span = {begin, name_end - begin};
+
+    // Skip ": "
+    size_t value_begin = std::min(name_end + 1, end);
+    while (value_begin < end && buffer[value_begin] == ' ') {
+        value_begin++;
+    }
+    // Rest is the value
+    value_span = {value_begin, end - value_begin};
+    if (id == known_header::UNKNOWN) {
+        hash = known_header::hash(buffer + begin, name_span.length);
+    }
+    decoded = true;
+}
 
 header_property &header_property::operator=(header_property other) {
     swap(*this, other);
     return *this;
 }
 
-std::string to_string(header_property const &p) {
-    return p.name + ": " + p.value + "\r\n";
+bool header_property::has_name(char const *buffer, std::string const &lower_name) const {
+    if (own_name) {
+        return name == lower_name;
+    }
+    decode(buffer);
+    if (name_span.length != lower_name.length()) {
+        return false;
+    }
+    return equal_lower(buffer + name_span.offset, lower_name.data(), name_span.length);
+}
+
+known_header::id header_property::get_id() const {
+    return id;
+}
+
+uint32_t header_property::get_hash(char const *buffer) const {
+    if (!own_name) {
+        decode(buffer);
+    }
+    return hash;
+}
+
+char const *header_property::value_data(char const *buffer) const {
+    if (own_value) {
+        return value.data();
+    }
+    decode(buffer);
+    return buffer + value_span.offset;
+}
+
+std::string header_property::get_name(char const *buffer) const {
+    if (own_name) {
+        return name;
+    }
+    decode(buffer);
+    return to_lower(std::string(buffer + name_span.offset, name_span.length));
+}
+
+std::string header_property::get_value(char const *buffer) const {
+    if (own_value) {
+        return value;
+    }
+    decode(buffer);
+    return std::string(buffer + value_span.offset, value_span.length);
+}
+
+bool header_property::value_is(char const *buffer, char const *lower_value) const {
+    char const *data = value_data(buffer);
+    size_t length = own_value ? value.size() : value_span.length;
+    return strlen(lower_value) == length && equal_lower(data, lower_value, length);
+}
+
+size_t header_property::get_number(char const *buffer) const {
+    char const *data = value_data(buffer);
+    char const *end = data + (own_value ? value.size() : value_span.length);
+    // Trailing whitespace isn't part of value
+    while (end > data && (end[-1] == ' ' || end[-1] == '\t')) {
+        end--;
+    }
+    if (data == end) {
+        throw annotated_exception("header", "empty number");
+    }
+    size_t result = 0;
+    for (; data < end; data++) {
+        if (!isdigit(*data)) {
+            throw annotated_exception("header", "bad number: " + get_value(buffer));
+        }
+        size_t digit = (size_t) (*data - '0');
+        if (result > (std::numeric_limits<size_t>::max() - digit) / 10) {
+            throw annotated_exception("header", "too big number: " + get_value(buffer));
+        }
+        result = result * 10 + digit;
+    }
+    return result;
+}
+
+void header_property::set_value(std::string const &value) {
+    this->value = value;
+    own_value = true;
+}
+
+void header_property::append_to(std::string &result, char const *buffer) const {
+    if (!own_name || !own_value) {
+        decode(buffer);
+    }
+    if (own_name) {
+        result += name;
+    } else {
+        result.append(buffer + name_span.offset, name_span.length);
+    }
+    result += ": ";
+    if (own_value) {
+        result += value;
+    } else {
+        result.append(buffer + value_span.offset, value_span.length);
+    }
+    result += "\r\n";
+}
+
+bool header_property::is_changed() const {
+    return own_name || own_value;
+}
+
+header_span header_property::get_line() const {
+    return header_span{line.offset, line.length + 2};
 }
 
 void swap(header_property &first, header_property &second) {
+    std::swap(first.line, second.line);
+    std::swap(first.name_span, second.name_span);
+    std::swap(first.value_span, second.value_span);
+    std::swap(first.decoded, second.decoded);
+    std::swap(first.own_name, second.own_name);
+    std::swap(first.own_value, second.own_value);
     std::swap(first.name, second.name);
     std::swap(first.value, second.value);
+    std::swap(first.id, second.id);
+    std::swap(first.hash, second.hash);
 }
 
 // Request from client
 
-request_line::request_line() : type(""), url(""), http("") {}
+request_line::request_line() : type(""), url(""), http(""), changed(true) {}
 
-request_line::request_line(request_type type, std::string url) : url(url), http("HTTP/1.1") {
+request_line::request_line(request_type type, std::string url) : url(url), http("HTTP/1.1"), changed(true) {
     switch (type) {
         case GET:
             this->type = "GET";
@@ -62,28 +294,32 @@ request_line::request_line(request_type type, std::string url) : url(url), http(
     }
 }
 
-request_line::request_line(std::string const &line) {
-    size_t begin = 0;
-    size_t end = line.find(' ', begin);
-    type = line.substr(begin, end - begin);
+request_line::request_line(std::string const &line) : request_line(line.data(), line.size()) {}
+
+request_line::request_line(char const *line, size_t length) : changed(false) {
+    char const *line_end = line + length;
+    char const *begin = line;
+    char const *end = byte_scan::find(begin, line_end, ' ');
+    type.assign(begin, end);
 
-    begin = end + 1;
-    end = line.find(' ', begin);
+    begin = std::min(end + 1, line_end);
+    end = byte_scan::find(begin, line_end, ' ');
 
-    if (line[begin] != '/') {
+    if (begin < end && *begin != '/') {
 //		 Absolute address
-        begin = line.find(':', begin); // find "http:"
-        begin = line.find('/', begin + 3); // skip "://" and find '/'
+        begin = std::find(begin, end, ':'); // find "http:"
+        begin = std::find(std::min(begin + 3, end), end, '/'); // skip "://" and find '/'
+        changed = true;
     }
 
-    url = line.substr(begin, end - begin);
+    url.assign(begin, end);
 
-    begin = end + 1;
-    http = line.substr(begin, line.size() - begin);
+    begin = std::min(end + 1, line_end);
+    http.assign(begin, line_end);
 }
 
 request_line::request_line(request_line const &other) :
-        type(other.type), url(other.url), http(other.http) {
+        type(other.type), url(other.url), http(other.http), changed(other.changed) {
 }
 
 request_line::request_line(request_line &&other) : request_line() {
@@ -114,6 +350,11 @@ std::string request_line::get_url() const {
 
 void request_line::set_url(std::string const &url) {
     this->url = url;
+    changed = true;
+}
+
+bool request_line::is_changed() const {
+    return changed;
 }
 
 std::string to_string(request_line const &line) {
@@ -124,33 +365,40 @@ void swap(request_line &first, request_line &second) {
     std::swap(first.type, second.type);
     std::swap(first.url, second.url);
     std::swap(first.http, second.http);
+    std::swap(first.changed, second.changed);
 }
 
 // Response from server
 
-response_line::response_line() : code(-1), description(""), http("") {}
+response_line::response_line() : code(-1), description(""), http(""), changed(true) {}
 
 response_line::response_line(int code, std::string description) : code(code), description(description),
-                                                                  http("HTTP/1.1") {}
+                                                                  http("HTTP/1.1"), changed(true) {}
+
+response_line::response_line(std::string const &line) : response_line(line.data(), line.size()) {}
 
-response_line::response_line(std::string const &line) : response_line() {
-    size_t begin = 0;
-    size_t end = line.find(' ', begin);
-    http = line.substr(begin, end - begin);
+response_line::response_line(char const *line, size_t length) : response_line() {
+    char const *line_end = line + length;
+    char const *begin = line;
+    char const *end = byte_scan::find(begin, line_end, ' ');
+    http.assign(begin, end);
+    changed = false;
     // Skip ' '
-    begin = end + 1;
-    end = line.find(' ', begin);
+    begin = std::min(end + 1, line_end);
+    end = byte_scan::find(begin, line_end, ' ');
 
-    code = std::stoi(line.substr(begin, end - begin));
+    code = 0;
+    for (char const *digit = begin; digit < end && isdigit(*digit); digit++) {
+        code = code * 10 + (*digit - '0');
+    }
 
     // Skip ' '
-    begin = end + 1;
-    description = line.substr(begin, line.size() - begin);
+    begin = std::min(end + 1, line_end);
+    description.assign(begin, line_end);
 }
 
 response_line::response_line(response_line const &other) :
-        code(other.code), description(other.description), http(
-        other.http) {
+        code(other.code), description(other.description), http(other.http), changed(other.changed) {
 }
 
 response_line::response_line(response_line &&other) : response_line() {
@@ -170,6 +418,10 @@ std::string response_line::get_description() const {
     return description;
 }
 
+bool response_line::is_changed() const {
+    return changed;
+}
+
 std::string to_string(response_line const &line) {
     return line.http + " " + std::to_string(line.code) + " " + line.description + "\r\n";
 }
@@ -178,11 +430,12 @@ void swap(response_line &first, response_line &second) {
     std::swap(first.code, second.code);
     std::swap(first.description, second.description);
     std::swap(first.http, second.http);
+    std::swap(first.changed, second.changed);
 }
 
 bool should_cache(response_header const &header) {
-    if (header.has_property("cache-control")) {
-        std::string value = to_lower(header.get_property("cache_control"));
+    if (header.has_property(known_header::CACHE_CONTROL)) {
+        std::string value = to_lower(header.get_property(known_header::CACHE_CONTROL));
         if (value.find("no-cache") != std::string::npos ||
             value.find("no-store") != std::string::npos ||
             value.find("must-revalidate") != std::string::npos ||
@@ -192,38 +445,36 @@ bool should_cache(response_header const &header) {
         }
     }
 
-    if (header.has_property("pragma")) {
-        std::string value = to_lower(header.get_property("pragma"));
+    if (header.has_property(known_header::PRAGMA)) {
+        std::string value = to_lower(header.get_property(known_header::PRAGMA));
         if (value.find("no-cache") != std::string::npos) {
             return false;
         }
     }
 
-    if (header.has_property("cache") &&
-        to_lower(header.get_property("cache")).compare("none") == 0) {
+    if (header.property_is(known_header::CACHE, "none")) {
         return false;
     }
 
-    return !(!header.has_property("etag") && !header.has_property("last-modified"));
+    return !(!header.has_property(known_header::ETAG) && !header.has_property(known_header::LAST_MODIFIED));
 
 }
 
 request_header make_validate_header(request_header rqst, response_header response) {
     request_header header(rqst.get_request_line());
-    header.set_property("host", rqst.get_property("host"));
-    if (response.has_property("etag")) {
-        header.set_property("if-none-match", response.get_property("etag"));
+    header.set_property(known_header::HOST, rqst.get_property(known_header::HOST));
+    if (response.has_property(known_header::ETAG)) {
+        header.set_property(known_header::IF_NONE_MATCH, response.get_property(known_header::ETAG));
     }
-    if (response.has_property("last-modified")) {
-        header.set_property("if-modified-since", response.get_property("last-modified"));
+    if (response.has_property(known_header::LAST_MODIFIED)) {
+        header.set_property(known_header::IF_MODIFIED_SINCE, response.get_property(known_header::LAST_MODIFIED));
     }
-    header.set_property("connection", rqst.get_property("connection"));
+    header.set_property(known_header::CONNECTION, rqst.get_property(known_header::CONNECTION));
     return header;
 }
 
 std::string to_url(request_header const &request) {
-    std::string url = request.get_property("host");
+    std::string url = request.get_property(known_header::HOST);
     url += request.get_request_line().get_url();
     return url;
 }
-
@@ -3,16 +3,51 @@
 
 #include <vector>
 #include <string>
+#include <memory>
+#include <cstdint>
 #include "../util/util.h"
+#include "../util/byte_scan.h"
 
-// Struct that contains HTTP-header property (E.G. "Host: google.com")
+// Bytes of parsed header, that are shared by its copies. They can be in receive buffer of message or in own copy
+using header_buffer = std::shared_ptr<char const>;
+
+header_buffer make_header_buffer(std::string const &message);
+
+// Part of header buffer
+struct header_span {
+    size_t offset, length;
+};
+
+// Well-known headers. Header keeps slot for each of them, so they are found without comparing names
+struct known_header {
+    enum id {
+        HOST, CONNECTION, PROXY_CONNECTION, CONTENT_LENGTH, TRANSFER_ENCODING, CACHE_CONTROL, PRAGMA, CACHE, ETAG,
+        LAST_MODIFIED, IF_NONE_MATCH, IF_MODIFIED_SINCE, UNKNOWN
+    };
+    static const size_t COUNT = UNKNOWN;
+
+    // Id of name in any case or UNKNOWN
+    static id find(char const *name, size_t length);
+
+    // Id of name, that starts line and is followed by ':', or UNKNOWN. Only few bytes of line are compared
+    static id find_in_line(char const *line, size_t length);
+
+    // Name in lower case
+    static std::string name(id header);
+
+    // Hash of name, that ignores case. Other headers are found by it
+    static uint32_t hash(char const *name, size_t length);
+};
+
+// Struct that contains HTTP-header property (E.G. "Host: google.com"). Parsed property refers to buffer of header,
+// strings are made only for properties, that were set. Line is decoded (name and value are found) on the first
+// access, so lines, that proxy doesn't look at, cost only their recognition
 struct header_property {
 public:
-    std::string name, value;
-
     header_property();
 
-    explicit header_property(std::string const &property);
+    // Take line [begin, end) of buffer
+    header_property(char const *buffer, size_t begin, size_t end);
 
     header_property(std::string const &name, std::string const &value);
 
@@ -22,9 +57,49 @@ public:
 
     header_property &operator=(header_property other);
 
-    friend std::string to_string(header_property const &p);
+    // Compare name ignoring case. Name should be in lower case
+    bool has_name(char const *buffer, std::string const &lower_name) const;
+
+    known_header::id get_id() const;
+
+    uint32_t get_hash(char const *buffer) const;
+
+    std::string get_name(char const *buffer) const;
+
+    std::string get_value(char const *buffer) const;
+
+    // Compare value ignoring case without copying. Value should be in lower case
+    bool value_is(char const *buffer, char const *lower_value) const;
+
+    // Value as a non-negative number. Throws annotated_exception, if value isn't a number or doesn't fit in size_t
+    size_t get_number(char const *buffer) const;
+
+    void set_value(std::string const &value);
+
+    // Append "name: value\r\n"
+    void append_to(std::string &result, char const *buffer) const;
+
+    // Property was set, so its line in buffer isn't valid
+    bool is_changed() const;
+
+    // Line of parsed property in buffer with "\r\n"
+    header_span get_line() const;
 
     friend void swap(header_property &first, header_property &second);
+
+private:
+    // Find spans of name and value in line and hash of unknown name
+    void decode(char const *buffer) const;
+
+    char const *value_data(char const *buffer) const;
+
+    header_span line;                           // Parsed line without "\r\n"
+    mutable header_span name_span, value_span;
+    mutable bool decoded;
+    bool own_name, own_value;                   // Strings are used instead of spans
+    std::string name, value;
+    known_header::id id;
+    mutable uint32_t hash;                      // Only for unknown headers
 };
 
 // Template struct for http header. <Line> is for the first line of header (response_line or request_line)
@@ -37,22 +112,37 @@ public:
 
     explicit http_header(std::string const &message);
 
+    // Parse header, that takes the first length bytes of buffer (with the empty line)
+    http_header(header_buffer buffer, size_t length);
+
     http_header(http_header<Line> const &other);
 
     http_header(http_header<Line> &&other);
 
     http_header<Line> &operator=(http_header<Line> other);
 
-    // Functions for work with properties
-    std::string get_property(std::string name) const;
+    // Functions for work with properties. Names of properties should be in lower case
+    std::string get_property(known_header::id name) const;
+
+    std::string get_property(std::string const &name) const;
+
+    // Value of property as a number (0, if there is no property). Throws annotated_exception for bad value
+    size_t get_number(known_header::id name) const;
+
+    bool has_property(known_header::id name) const;
+
+    bool has_property(std::string const &name) const;
 
-    int get_int(std::string name) const;
+    // Compare value ignoring case without copying it. Value should be in lower case
+    bool property_is(known_header::id name, char const *lower_value) const;
 
-    bool has_property(std::string name) const;
+    void set_property(known_header::id name, std::string const &value);
 
-    void set_property(std::string name, std::string value);
+    void set_property(std::string const &name, std::string const &value);
 
-    void erase_property(std::string name);
+    void erase_property(known_header::id name);
+
+    void erase_property(std::string const &name);
 
     // Functions for with first line of header
     void set_request_line(Line line);
@@ -61,6 +151,14 @@ public:
 
     Line &get_request_line();
 
+    // Header differs from bytes, that were parsed
+    bool is_changed() const;
+
+    // Pass header in order by parts: raw(header_span) for bytes of buffer, that are unchanged, and
+    // changed(std::string const &) for changed lines. Unchanged header is passed as one span
+    template<typename Raw, typename Changed>
+    void serialize(Raw raw, Changed changed) const;
+
     template<typename L>
     friend std::string to_string(http_header<L> const &header);
 
@@ -68,11 +166,34 @@ public:
     friend void swap(http_header<L> &first, http_header<L> &second);
 
 private:
+    static const size_t BUCKETS = 16;
+
+    void parse(size_t length);
+
+    // Index of the first property with name or -1
+    int find_property(std::string const &name) const;
+
+    // Add property to slots of well-known names
+    void index(int property);
+
+    void index_properties();
+
+    // Put properties with other names to buckets. It's done on the first lookup of such name
+    void index_buckets() const;
+
+    void erase(int property);
 
     using properties_t = std::vector<header_property>;
 
+    header_buffer buffer;
+    size_t length, line_length;         // Parsed bytes of buffer and bytes of the first line without "\r\n"
+    bool dirty;                         // Properties were set or erased
     Line request_line;
     properties_t properties;
+    int known[known_header::COUNT];     // Index of the first property with well-known name or -1
+    mutable bool bucketed;              // Buckets are valid
+    mutable int buckets[BUCKETS];       // Index of the first property of bucket of other names or -1
+    mutable std::vector<int> next;      // Next property with the same bucket or -1
 };
 
 struct request_line {
@@ -86,6 +207,8 @@ struct request_line {
 
     explicit request_line(std::string const &message);
 
+    request_line(char const *line, size_t length);
+
     request_line(request_line const &other);
 
     request_line(request_line &&other);
@@ -98,6 +221,9 @@ struct request_line {
 
     void set_url(std::string const &url);
 
+    // Line differs from parsed one (absolute URL was cut or URL was set)
+    bool is_changed() const;
+
     friend std::string to_string(request_line const &request);
 
     friend void swap(request_line &first, request_line &second);
@@ -106,6 +232,7 @@ private:
     std::string type;
     std::string url;
     std::string http;
+    bool changed;
 };
 
 struct response_line {
@@ -113,6 +240,8 @@ struct response_line {
 
     explicit response_line(std::string const &message);
 
+    response_line(char const *line, size_t length);
+
     response_line(int code, std::string description);
 
     response_line(response_line const &other);
@@ -125,6 +254,9 @@ struct response_line {
 
     std::string get_description() const;
 
+    // Line wasn't parsed
+    bool is_changed() const;
+
     friend std::string to_string(response_line const &response);
 
     friend void swap(response_line &first, response_line &second);
@@ -133,6 +265,7 @@ private:
     int code;
     std::string description;
     std::string http;
+    bool changed;
 };
 
 using request_header = http_header<request_line>;
@@ -145,50 +278,74 @@ request_header make_validate_header(request_header rqst, response_header respons
 std::string to_url(request_header const &request);
 
 template<typename Line>
-http_header<Line>::http_header() : request_line(), properties() {
+http_header<Line>::http_header() :
+        buffer(), length(0), line_length(0), dirty(false), request_line(), properties(), bucketed(false), next() {
+    index_properties();
 }
 
 template<typename Line>
-http_header<Line>::http_header(Line line) : request_line(line), properties{} {
-
+http_header<Line>::http_header(Line line) :
+        buffer(), length(0), line_length(0), dirty(false), request_line(line), properties{}, bucketed(false), next() {
+    index_properties();
 }
 
 template<typename Line>
-http_header<Line>::http_header(std::string const &message) : properties() {
-    size_t begin = 0;
-    size_t end = message.find('\r', begin);
-    std::string header = message.substr(begin, end - begin);
+http_header<Line>::http_header(std::string const &message) :
+        buffer(make_header_buffer(message)), length(0), line_length(0), dirty(false), properties(), bucketed(false),
+        next() {
+    parse(message.size());
+}
 
-    request_line = Line(header);
+template<typename Line>
+http_header<Line>::http_header(header_buffer buffer, size_t length) :
+        buffer(std::move(buffer)), length(0), line_length(0), dirty(false), properties(), bucketed(false), next() {
+    parse(length);
+}
 
-    while (end < message.size()) {
+template<typename Line>
+void http_header<Line>::parse(size_t length) {
+    char const *message = buffer.get();
+    char const *message_end = message + length;
+    char const *end = byte_scan::find(message, message_end, '\r');
+
+    request_line = Line(message, end - message);
+    line_length = end - message;
+
+    // Lines are counted, so properties are allocated once
+    properties.reserve(byte_scan::count(end, message_end, '\n'));
+    this->length = length;
+    while (end < message_end) {
         // Skipping \r \n
-        begin = end + 2;
-        end = message.find('\r', begin);
+        char const *begin = end + 2;
+        end = byte_scan::find(begin, message_end, '\r');
 
-        // If we found the end of the header
-        if (begin == end) {
+        // If we found the end of the header (bytes after it aren't header)
+        if (begin >= end) {
+            this->length = std::min((size_t) (end - message) + 2, length);
             break;
         }
 
-        std::string property = message.substr(begin, end - begin);
-        properties.push_back(header_property(property));
+        properties.emplace_back(message, begin - message, end - message);
     }
+    index_properties();
 
     // Property Proxy-Connection isn't working on some servers
-    if (has_property("proxy-connection")) {
-        std::string value = get_property("proxy-connection");
-        erase_property("proxy-connection");
+    if (has_property(known_header::PROXY_CONNECTION)) {
+        std::string value = get_property(known_header::PROXY_CONNECTION);
+        erase_property(known_header::PROXY_CONNECTION);
 
-        if (!has_property("connection")) {
-            set_property("connection", value);
+        if (!has_property(known_header::CONNECTION)) {
+            set_property(known_header::CONNECTION, value);
         }
     }
 }
 
 template<typename Line>
 http_header<Line>::http_header(http_header<Line> const &other) :
-        request_line(other.request_line), properties(other.properties) {
+        buffer(other.buffer), length(other.length), line_length(other.line_length), dirty(other.dirty),
+        request_line(other.request_line), properties(other.properties), bucketed(other.bucketed), next(other.next) {
+    std::copy_n(other.known, known_header::COUNT, known);
+    std::copy_n(other.buckets, BUCKETS, buckets);
 }
 
 template<typename Line>
@@ -203,53 +360,137 @@ http_header<Line> &http_header<Line>::operator=(http_header<Line> other) {
 }
 
 template<typename Line>
-bool http_header<Line>::has_property(std::string name) const {
-    for (typename properties_t::const_iterator it = properties.cbegin();
-         it != properties.cend(); it++) {
-        if (it->name.compare(name) == 0) {
-            return true;
+int http_header<Line>::find_property(std::string const &name) const {
+    known_header::id id = known_header::find(name.data(), name.size());
+    if (id != known_header::UNKNOWN) {
+        return known[id];
+    }
+    if (!bucketed) {
+        index_buckets();
+    }
+    uint32_t hash = known_header::hash(name.data(), name.size());
+    for (int i = buckets[hash % BUCKETS]; i != -1; i = next[i]) {
+        if (properties[i].get_hash(buffer.get()) == hash && properties[i].has_name(buffer.get(), name)) {
+            return i;
         }
     }
-    return false;
+    return -1;
 }
 
 template<typename Line>
-std::string http_header<Line>::get_property(std::string name) const {
-    for (typename properties_t::const_iterator it = properties.cbegin();
-         it != properties.cend(); it++) {
-        if (it->name.compare(name) == 0) {
-            return it->value;
-        }
+void http_header<Line>::index(int property) {
+    known_header::id id = properties[property].get_id();
+    if (id == known_header::UNKNOWN) {
+        bucketed = false;
+    } else if (known[id] == -1) {
+        known[id] = property;
     }
-    return "";
 }
 
 template<typename Line>
-int http_header<Line>::get_int(std::string name) const {
-    std::string value = get_property(name);
-    return value.empty() ? 0 : std::stoi(value);
+void http_header<Line>::index_properties() {
+    std::fill_n(known, known_header::COUNT, -1);
+    std::fill_n(buckets, BUCKETS, -1);
+    for (size_t i = 0; i < properties.size(); i++) {
+        index((int) i);
+    }
+    bucketed = false;
 }
 
 template<typename Line>
-void http_header<Line>::set_property(std::string name, std::string value) {
-    for (auto it = properties.begin();
-         it != properties.end(); it++) {
-        if (it->name.compare(name) == 0) {
-            it->value = value;
-            return;
+void http_header<Line>::index_buckets() const {
+    // Properties of bucket are kept in order, so the first one with name is found
+    int last[BUCKETS];
+    std::fill_n(buckets, BUCKETS, -1);
+    next.assign(properties.size(), -1);
+    for (size_t i = 0; i < properties.size(); i++) {
+        if (properties[i].get_id() != known_header::UNKNOWN) {
+            continue;
+        }
+        size_t bucket = properties[i].get_hash(buffer.get()) % BUCKETS;
+        if (buckets[bucket] == -1) {
+            buckets[bucket] = (int) i;
+        } else {
+            next[last[bucket]] = (int) i;
         }
+        last[bucket] = (int) i;
     }
-    properties.push_back(header_property(name, value));
+    bucketed = true;
 }
 
 template<typename Line>
-void http_header<Line>::erase_property(std::string name) {
-    for (auto it = properties.begin(); it != properties.end(); it++) {
-        if (it->name.compare(name) == 0) {
-            properties.erase(it);
-            return;
-        }
+void http_header<Line>::erase(int property) {
+    if (property != -1) {
+        properties.erase(properties.begin() + property);
+        index_properties();
+        dirty = true;
+    }
+}
+
+template<typename Line>
+bool http_header<Line>::has_property(known_header::id name) const {
+    return known[name] != -1;
+}
+
+template<typename Line>
+bool http_header<Line>::has_property(std::string const &name) const {
+    return find_property(name) != -1;
+}
+
+template<typename Line>
+std::string http_header<Line>::get_property(known_header::id name) const {
+    return known[name] == -1 ? "" : properties[known[name]].get_value(buffer.get());
+}
+
+template<typename Line>
+std::string http_header<Line>::get_property(std::string const &name) const {
+    int property = find_property(name);
+    return property == -1 ? "" : properties[property].get_value(buffer.get());
+}
+
+template<typename Line>
+size_t http_header<Line>::get_number(known_header::id name) const {
+    return known[name] == -1 ? 0 : properties[known[name]].get_number(buffer.get());
+}
+
+template<typename Line>
+bool http_header<Line>::property_is(known_header::id name, char const *lower_value) const {
+    return known[name] != -1 && properties[known[name]].value_is(buffer.get(), lower_value);
+}
+
+template<typename Line>
+void http_header<Line>::set_property(known_header::id name, std::string const &value) {
+    if (known[name] != -1) {
+        properties[known[name]].set_value(value);
+        dirty = true;
+        return;
     }
+    dirty = true;
+    properties.push_back(header_property(known_header::name(name), value));
+    index((int) properties.size() - 1);
+}
+
+template<typename Line>
+void http_header<Line>::set_property(std::string const &name, std::string const &value) {
+    int property = find_property(name);
+    if (property != -1) {
+        properties[property].set_value(value);
+        dirty = true;
+        return;
+    }
+    dirty = true;
+    properties.push_back(header_property(name, value));
+    index((int) properties.size() - 1);
+}
+
+template<typename Line>
+void http_header<Line>::erase_property(known_header::id name) {
+    erase(known[name]);
+}
+
+template<typename Line>
+void http_header<Line>::erase_property(std::string const &name) {
+    erase(find_property(name));
 }
 
 template<typename Line>
@@ -269,19 +510,64 @@ Line &http_header<Line>::get_request_line() {
 
 template<typename Line>
 void swap(http_header<Line> &first, http_header<Line> &second) {
+    swap(first.buffer, second.buffer);
+    std::swap(first.length, second.length);
+    std::swap(first.line_length, second.line_length);
+    std::swap(first.dirty, second.dirty);
     swap(first.request_line, second.request_line);
     first.properties.swap(second.properties);
+    std::swap(first.known, second.known);
+    std::swap(first.bucketed, second.bucketed);
+    std::swap(first.buckets, second.buckets);
+    first.next.swap(second.next);
 }
 
 template<typename Line>
-std::string to_string(http_header<Line> const &header) {
-    std::string result = to_string(header.request_line);
+bool http_header<Line>::is_changed() const {
+    return !buffer || dirty || request_line.is_changed();
+}
 
-    for (typename http_header<Line>::properties_t::const_iterator it =
-            header.properties.cbegin(); it != header.properties.cend(); it++) {
-        result.append(to_string(*it));
+template<typename Line>
+template<typename Raw, typename Changed>
+void http_header<Line>::serialize(Raw raw, Changed changed) const {
+    if (!is_changed()) {
+        raw(header_span{0, length});
+        return;
+    }
+    if (buffer && !request_line.is_changed()) {
+        raw(header_span{0, line_length + 2});
+    } else {
+        changed(to_string(request_line));
+    }
+
+    // Erased properties are skipped, added ones are at the end
+    std::string line;
+    for (typename properties_t::const_iterator it = properties.cbegin(); it != properties.cend(); it++) {
+        if (!it->is_changed()) {
+            raw(it->get_line());
+            continue;
+        }
+        line.clear();
+        it->append_to(line, buffer.get());
+        changed(line);
     }
-    result += "\r\n";
+
+    if (buffer) {
+        raw(header_span{length - 2, 2});
+    } else {
+        changed(std::string("\r\n"));
+    }
+}
+
+template<typename Line>
+std::string to_string(http_header<Line> const &header) {
+    std::string result;
+    char const *buffer = header.buffer.get();
+    header.serialize([&result, buffer](header_span span) {
+        result.append(buffer + span.offset, span.length);
+    }, [&result](std::string const &line) {
+        result += line;
+    });
     return result;
 }
 
@@ -0,0 +1,141 @@
+#include "segment_chain.h"
+#include "buffer_pool.h"
+#include <algorithm>
+#include <unordered_map>
+
+
+buffer_statistics &get_buffer_statistics() {
+    static thread_local buffer_statistics stats = {0, 0, 0, 0, 0, 0, 0};
+    return stats;
+}
+
+slab::slab(size_t capacity, bool pooled)
+        : memory(), size(pooled ? buffer_pool::block_size(capacity) : capacity), pooled(pooled) {
+    if (pooled) {
+        memory = buffer_pool::acquire(size);
+        get_buffer_statistics().slabs++;
+    } else {
+        memory = new char[size];
+        get_buffer_statistics().allocations++;
+    }
+}
+
+slab::~slab() {
+    if (pooled) {
+        buffer_pool::release(memory, size);
+    } else {
+        delete[] memory;
+    }
+}
+
+char *slab::data() {
+    return memory;
+}
+
+char const *slab::data() const {
+    return memory;
+}
+
+size_t slab::capacity() const {
+    return size;
+}
+
+slab_ptr make_slab(size_t capacity) {
+    return std::make_shared<slab>(capacity);
+}
+
+slab_ptr make_exact_slab(size_t capacity) {
+    return std::make_shared<slab>(capacity, false);
+}
+
+char const *segment::data() const {
+    return owner->data() + offset;
+}
+
+segment_chain::segment_chain() : segments(), total(0) {}
+
+void segment_chain::append(slab_ptr const &owner, size_t offset, size_t length) {
+    if (length == 0) {
+        return;
+    }
+    total += length;
+    if (!segments.empty()) {
+        segment &last = segments.back();
+        if (last.owner == owner && last.offset + last.length == offset) {
+            last.length += length;
+            return;
+        }
+    }
+    segments.push_back(segment{owner, offset, length});
+}
+
+void segment_chain::append(std::string const &data) {
+    if (data.empty()) {
+        return;
+    }
+    slab_ptr owner = make_slab(data.length());
+    std::copy(data.begin(), data.end(), owner->data());
+    get_buffer_statistics().copied += data.length();
+    // Slab is full, so the next append can't extend this segment
+    append(owner, 0, data.length());
+}
+
+size_t segment_chain::parts() const {
+    return segments.size();
+}
+
+size_t segment_chain::size() const {
+    return total;
+}
+
+bool segment_chain::empty() const {
+    return total == 0;
+}
+
+segment const &segment_chain::operator[](size_t part) const {
+    return segments[part];
+}
+
+std::string segment_chain::to_string(size_t part) const {
+    return std::string(segments[part].data(), segments[part].length);
+}
+
+size_t segment_chain::release_front(size_t parts) {
+    size_t released = 0;
+    for (size_t i = 0; i < parts; i++) {
+        released += segments[i].length;
+    }
+    segments.erase(segments.begin(), segments.begin() + parts);
+    total -= released;
+    return released;
+}
+
+segment_chain segment_chain::compact() const {
+    std::unordered_map<slab const *, size_t> used;
+    for (segment const &part : segments) {
+        used[part.owner.get()] += part.length;
+    }
+    segment_chain result;
+    size_t i = 0;
+    while (i < segments.size()) {
+        segment const &part = segments[i];
+        if (used[part.owner.get()] * 2 > part.owner->capacity()) {
+            result.append(part.owner, part.offset, part.length);
+            i++;
+            continue;
+        }
+        size_t end = i, length = 0;
+        while (end < segments.size() && used[segments[end].owner.get()] * 2 <= segments[end].owner->capacity()) {
+            length += segments[end++].length;
+        }
+        slab_ptr owner = make_exact_slab(length);
+        size_t offset = 0;
+        for (; i < end; i++) {
+            std::copy(segments[i].data(), segments[i].data() + segments[i].length, owner->data() + offset);
+            offset += segments[i].length;
+        }
+        get_buffer_statistics().copied += length;
+        result.append(owner, 0, length);
+    }
+    return result;
+}
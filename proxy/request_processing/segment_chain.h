@@ -0,0 +1,96 @@
+#ifndef PROXY_SERVER_SEGMENT_CHAIN_H
+#define PROXY_SERVER_SEGMENT_CHAIN_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Counters of buffers of messages in the current thread
+struct buffer_statistics {
+    size_t allocations;     // Allocations of memory for slabs (arenas or big blocks)
+    size_t slabs;           // Slabs taken from pool
+    size_t received;        // Bytes read from sockets to slabs
+    size_t copied;          // Bytes copied between buffers after they were read or created
+    size_t writes;          // Calls of write by messages
+    size_t zerocopy_sends;  // Writes with MSG_ZEROCOPY
+    size_t zerocopy_copied; // Zero-copy sends, that were copied by kernel anyway
+};
+
+buffer_statistics &get_buffer_statistics();
+
+// Block of memory from buffer_pool, that is shared by segments referring to it.
+// Capacity is rounded up to the size of block. Block, that isn't pooled, has exact capacity
+struct slab {
+    explicit slab(size_t capacity, bool pooled = true);
+
+    slab(slab const &other) = delete;
+
+    slab &operator=(slab const &other) = delete;
+
+    // Block is returned to pool or freed
+    ~slab();
+
+    char *data();
+
+    char const *data() const;
+
+    size_t capacity() const;
+
+private:
+    char *memory;
+    size_t size;
+    bool pooled;
+};
+
+using slab_ptr = std::shared_ptr<slab>;
+
+slab_ptr make_slab(size_t capacity);
+
+// Slab of exact capacity outside of pool, for data that is kept long
+slab_ptr make_exact_slab(size_t capacity);
+
+// Part of slab
+struct segment {
+    slab_ptr owner;
+    size_t offset, length;
+
+    char const *data() const;
+};
+
+// Sequence of segments, that make up message. Copying of chain shares slabs instead of copying bytes
+struct segment_chain {
+    segment_chain();
+
+    // Append bytes, that were read into slab. Bytes, that follow the last segment in the same slab, extend it
+    void append(slab_ptr const &owner, size_t offset, size_t length);
+
+    // Append copy of string as separate segment
+    void append(std::string const &data);
+
+    // Number of segments
+    size_t parts() const;
+
+    // Number of bytes
+    size_t size() const;
+
+    bool empty() const;
+
+    segment const &operator[](size_t part) const;
+
+    std::string to_string(size_t part) const;
+
+    // Remove first parts. Returns number of removed bytes
+    size_t release_front(size_t parts);
+
+    // Chain with the same bytes, that doesn't pin mostly empty slabs. Segments of slab, that is filled
+    // by the chain for more than half, are shared, and other runs of segments are copied to exact slabs
+    segment_chain compact() const;
+
+private:
+    std::vector<segment> segments;
+    size_t total;
+};
+
+
+#endif //PROXY_SERVER_SEGMENT_CHAIN_H
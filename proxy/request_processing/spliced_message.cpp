@@ -0,0 +1,70 @@
+#include "spliced_message.h"
+
+
+pipe_pool::pipe_pool(size_t max_size) : pipes(), max_size(max_size) {}
+
+pipe_wrap pipe_pool::acquire() {
+    if (pipes.empty()) {
+        return pipe_wrap();
+    }
+    pipe_wrap pipe = std::move(pipes.back());
+    pipes.pop_back();
+    return pipe;
+}
+
+void pipe_pool::release(pipe_wrap &&pipe) {
+    if (pipes.size() < max_size) {
+        pipes.push_back(std::move(pipe));
+    }
+}
+
+size_t pipe_pool::size() const {
+    return pipes.size();
+}
+
+spliced_message::spliced_message(std::shared_ptr<pipe_pool> pool) : pool(pool), pipe(pool->acquire()), length(0),
+                                                                    full(false) {}
+
+spliced_message::~spliced_message() {
+    // Data, that is left in pipe, would be read by the next connection
+    if (length == 0) {
+        pool->release(std::move(pipe));
+    }
+}
+
+bool spliced_message::can_read() const {
+    return length < pipe.capacity() && !full;
+}
+
+bool spliced_message::can_write() const {
+    return length > 0;
+}
+
+size_t spliced_message::pending() const {
+    return length;
+}
+
+size_t spliced_message::capacity() const {
+    return pipe.capacity();
+}
+
+long spliced_message::read_from(file_descriptor const &fd) {
+    long read = pipe.splice_from(fd, pipe.capacity() - length);
+    if (read > 0) {
+        length += read;
+    } else if (read == file_descriptor::WOULD_BLOCK && length > 0) {
+        // Socket's data can take more pages of pipe, than its length. Reading waits for writing then,
+        // otherwise level-triggered socket would be reported ready every round
+        full = true;
+    }
+    return read;
+}
+
+long spliced_message::write_to(file_descriptor const &fd) {
+    long written = pipe.splice_to(fd, length);
+    if (written > 0) {
+        length -= written;
+        full = false;
+    }
+    return written;
+}
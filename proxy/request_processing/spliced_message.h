@@ -0,0 +1,58 @@
+#ifndef PROXY_SERVER_SPLICED_MESSAGE_H
+#define PROXY_SERVER_SPLICED_MESSAGE_H
+
+#include <memory>
+#include <vector>
+
+#include "../util/pipe_wrap.h"
+
+// Pipes, that are kept for reuse by next connections
+struct pipe_pool {
+    explicit pipe_pool(size_t max_size);
+
+    // Take pipe from pool, or create new one
+    pipe_wrap acquire();
+
+    // Return empty pipe to pool. If pool is full, pipe is closed
+    void release(pipe_wrap &&pipe);
+
+    size_t size() const;
+
+private:
+    std::vector<pipe_wrap> pipes;
+    size_t max_size;
+};
+
+// Raw message, that is kept in pipe and is moved between sockets by splice without copying to user space.
+// It has the same interface as raw_message
+struct spliced_message {
+    explicit spliced_message(std::shared_ptr<pipe_pool> pool);
+
+    spliced_message(spliced_message const &other) = delete;
+
+    spliced_message &operator=(spliced_message const &other) = delete;
+
+    // Pipe is returned to pool, if it's empty
+    ~spliced_message();
+
+    bool can_read() const;
+
+    bool can_write() const;
+
+    size_t pending() const;
+
+    size_t capacity() const;
+
+    long read_from(file_descriptor const &fd);
+
+    long write_to(file_descriptor const &fd);
+
+private:
+    std::shared_ptr<pipe_pool> pool;
+    pipe_wrap pipe;
+    size_t length;  // Number of bytes in pipe
+    bool full;      // Pipe has no free pages, though its capacity in bytes isn't reached
+};
+
+
+#endif //PROXY_SERVER_SPLICED_MESSAGE_H
@@ -0,0 +1,209 @@
+#include "byte_scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BYTE_SCAN_X86
+#endif
+
+namespace {
+    struct kernel_table {
+        char const *(*find)(char const *, char const *, char);
+
+        char const *(*find_header_end)(char const *, char const *);
+
+        size_t (*count)(char const *, char const *, char);
+
+        void (*to_lower)(char *, char *);
+
+        char const *name;
+    };
+
+    // Scalar kernels. They also finish tails, that are shorter than vector
+
+    char const *find_scalar(char const *begin, char const *end, char value) {
+        while (begin < end && *begin != value) {
+            begin++;
+        }
+        return begin;
+    }
+
+    char const *find_header_end_scalar(char const *begin, char const *end) {
+        for (; end - begin >= 4; begin++) {
+            if (begin[0] == '\r' && begin[1] == '\n' && begin[2] == '\r' && begin[3] == '\n') {
+                return begin + 4;
+            }
+        }
+        return nullptr;
+    }
+
+    size_t count_scalar(char const *begin, char const *end, char value) {
+        size_t result = 0;
+        for (; begin < end; begin++) {
+            result += (*begin == value);
+        }
+        return result;
+    }
+
+    void to_lower_scalar(char *begin, char *end) {
+        for (; begin < end; begin++) {
+            if (*begin >= 'A' && *begin <= 'Z') {
+                *begin += 'a' - 'A';
+            }
+        }
+    }
+
+#ifdef BYTE_SCAN_X86
+    // Vector kernels compare whole block with broadcast value and take positions from bit mask of result.
+    // "\r\n\r\n" is found as intersection of masks of '\r' and '\n' at the four shifts
+
+    __attribute__((target("sse2")))
+    char const *find_sse2(char const *begin, char const *end, char value) {
+        __m128i pattern = _mm_set1_epi8(value);
+        for (; end - begin >= 16; begin += 16) {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<__m128i const *>(begin));
+            unsigned mask = (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(block, pattern));
+            if (mask != 0) {
+                return begin + __builtin_ctz(mask);
+            }
+        }
+        return find_scalar(begin, end, value);
+    }
+
+    __attribute__((target("sse2")))
+    char const *find_header_end_sse2(char const *begin, char const *end) {
+        __m128i cr = _mm_set1_epi8('\r');
+        __m128i lf = _mm_set1_epi8('\n');
+        for (; end - begin >= 16 + 3; begin += 16) {
+            __m128i first = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const *>(begin)), cr);
+            __m128i second = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const *>(begin + 1)), lf);
+            __m128i third = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const *>(begin + 2)), cr);
+            __m128i fourth = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const *>(begin + 3)), lf);
+            __m128i all = _mm_and_si128(_mm_and_si128(first, second), _mm_and_si128(third, fourth));
+            unsigned mask = (unsigned) _mm_movemask_epi8(all);
+            if (mask != 0) {
+                return begin + __builtin_ctz(mask) + 4;
+            }
+        }
+        return find_header_end_scalar(begin, end);
+    }
+
+    __attribute__((target("sse2,popcnt")))
+    size_t count_sse2(char const *begin, char const *end, char value) {
+        __m128i pattern = _mm_set1_epi8(value);
+        size_t result = 0;
+        for (; end - begin >= 16; begin += 16) {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<__m128i const *>(begin));
+            result += __builtin_popcount((unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(block, pattern)));
+        }
+        return result + count_scalar(begin, end, value);
+    }
+
+    // Bytes are shifted, so that 'A'..'Z' become the smallest signed values, and letters are found by one compare
+    __attribute__((target("sse2")))
+    void to_lower_sse2(char *begin, char *end) {
+        __m128i shift = _mm_set1_epi8((char) (0x80 - 'A'));
+        __m128i bound = _mm_set1_epi8((char) (-128 + 26));
+        __m128i bit = _mm_set1_epi8(0x20);
+        for (; end - begin >= 16; begin += 16) {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<__m128i const *>(begin));
+            __m128i upper = _mm_cmpgt_epi8(bound, _mm_add_epi8(block, shift));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(begin), _mm_or_si128(block, _mm_and_si128(upper, bit)));
+        }
+        to_lower_scalar(begin, end);
+    }
+
+    __attribute__((target("avx2")))
+    char const *find_avx2(char const *begin, char const *end, char value) {
+        __m256i pattern = _mm256_set1_epi8(value);
+        for (; end - begin >= 32; begin += 32) {
+            __m256i block = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(begin));
+            unsigned mask = (unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, pattern));
+            if (mask != 0) {
+                return begin + __builtin_ctz(mask);
+            }
+        }
+        return find_sse2(begin, end, value);
+    }
+
+    __attribute__((target("avx2")))
+    char const *find_header_end_avx2(char const *begin, char const *end) {
+        __m256i cr = _mm256_set1_epi8('\r');
+        __m256i lf = _mm256_set1_epi8('\n');
+        for (; end - begin >= 32 + 3; begin += 32) {
+            __m256i first = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(begin)), cr);
+            __m256i second = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(begin + 1)), lf);
+            __m256i third = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(begin + 2)), cr);
+            __m256i fourth = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(begin + 3)), lf);
+            __m256i all = _mm256_and_si256(_mm256_and_si256(first, second), _mm256_and_si256(third, fourth));
+            unsigned mask = (unsigned) _mm256_movemask_epi8(all);
+            if (mask != 0) {
+                return begin + __builtin_ctz(mask) + 4;
+            }
+        }
+        return find_header_end_sse2(begin, end);
+    }
+
+    __attribute__((target("avx2,popcnt")))
+    size_t count_avx2(char const *begin, char const *end, char value) {
+        __m256i pattern = _mm256_set1_epi8(value);
+        size_t result = 0;
+        for (; end - begin >= 32; begin += 32) {
+            __m256i block = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(begin));
+            result += __builtin_popcount((unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, pattern)));
+        }
+        return result + count_scalar(begin, end, value);
+    }
+
+    __attribute__((target("avx2")))
+    void to_lower_avx2(char *begin, char *end) {
+        __m256i shift = _mm256_set1_epi8((char) (0x80 - 'A'));
+        __m256i bound = _mm256_set1_epi8((char) (-128 + 26));
+        __m256i bit = _mm256_set1_epi8(0x20);
+        for (; end - begin >= 32; begin += 32) {
+            __m256i block = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(begin));
+            __m256i upper = _mm256_cmpgt_epi8(bound, _mm256_add_epi8(block, shift));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(begin),
+                                _mm256_or_si256(block, _mm256_and_si256(upper, bit)));
+        }
+        to_lower_scalar(begin, end);
+    }
+#endif
+
+    kernel_table choose_kernels() {
+#ifdef BYTE_SCAN_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+            return {find_avx2, find_header_end_avx2, count_avx2, to_lower_avx2, "avx2"};
+        }
+        if (__builtin_cpu_supports("sse2") && __builtin_cpu_supports("popcnt")) {
+            return {find_sse2, find_header_end_sse2, count_sse2, to_lower_sse2, "sse2"};
+        }
+#endif
+        return {find_scalar, find_header_end_scalar, count_scalar, to_lower_scalar, "scalar"};
+    }
+
+    kernel_table const &get_kernels() {
+        static kernel_table const table = choose_kernels();
+        return table;
+    }
+}
+
+char const *byte_scan::find(char const *begin, char const *end, char value) {
+    return get_kernels().find(begin, end, value);
+}
+
+char const *byte_scan::find_header_end(char const *begin, char const *end) {
+    return get_kernels().find_header_end(begin, end);
+}
+
+size_t byte_scan::count(char const *begin, char const *end, char value) {
+    return get_kernels().count(begin, end, value);
+}
+
+void byte_scan::to_lower(char *begin, char *end) {
+    get_kernels().to_lower(begin, end);
+}
+
+char const *byte_scan::kernels() {
+    return get_kernels().name;
+}
@@ -0,0 +1,25 @@
+#ifndef PROXY_SERVER_BYTE_SCAN_H
+#define PROXY_SERVER_BYTE_SCAN_H
+
+#include <cstddef>
+
+// Scanning of header bytes. Kernels are chosen once by CPU: AVX2 or SSE2 on x86, scalar code on other CPUs
+struct byte_scan {
+    // Position of the first value in [begin, end) or end
+    static char const *find(char const *begin, char const *end, char value);
+
+    // Position after the first "\r\n\r\n" in [begin, end) or nullptr
+    static char const *find_header_end(char const *begin, char const *end);
+
+    // Number of values in [begin, end)
+    static size_t count(char const *begin, char const *end, char value);
+
+    // Lower ASCII letters of [begin, end) in place
+    static void to_lower(char *begin, char *end);
+
+    // Name of used kernels: "avx2", "sse2" or "scalar"
+    static char const *kernels();
+};
+
+
+#endif //PROXY_SERVER_BYTE_SCAN_H
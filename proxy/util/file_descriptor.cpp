@@ -47,6 +47,9 @@ long file_descriptor::read(void *message, size_t message_size) const {
     long read = ::read(fd, message, message_size);
     if (read == -1) {
         int err = errno;
+        if (err == EAGAIN || err == EWOULDBLOCK) {
+            return WOULD_BLOCK;
+        }
         throw annotated_exception("read", err);
     }
     return read;
@@ -56,11 +59,38 @@ long file_descriptor::write(void const *message, size_t message_size) const {
     long written = ::write(fd, message, message_size);
     if (written == -1) {
         int err = errno;
+        if (err == EAGAIN || err == EWOULDBLOCK) {
+            return WOULD_BLOCK;
+        }
         throw annotated_exception("write", err);
     }
     return written;
 }
 
+long file_descriptor::readv(iovec const *parts, int parts_number) const {
+    long read = ::readv(fd, parts, parts_number);
+    if (read == -1) {
+        int err = errno;
+        if (err == EAGAIN || err == EWOULDBLOCK) {
+            return WOULD_BLOCK;
+        }
+        throw annotated_exception("readv", err);
+    }
+    return read;
+}
+
+long file_descriptor::writev(iovec const *parts, int parts_number) const {
+    long written = ::writev(fd, parts, parts_number);
+    if (written == -1) {
+        int err = errno;
+        if (err == EAGAIN || err == EWOULDBLOCK) {
+            return WOULD_BLOCK;
+        }
+        throw annotated_exception("writev", err);
+    }
+    return written;
+}
+
 void swap(file_descriptor &first, file_descriptor &second) {
     std::swap(first.fd, second.fd);
 }
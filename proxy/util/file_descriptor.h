@@ -2,10 +2,14 @@
 #define PROXY_SERVER_FILE_DESCRIPTOR_H
 
 #include <unistd.h>
+#include <sys/uio.h>
 #include <cstddef>
 #include <string>
 
 struct file_descriptor {
+    // Returned by read and write, when non-blocking operation would block
+    static const long WOULD_BLOCK = -1;
+
     explicit file_descriptor(int fd);
 
     file_descriptor(file_descriptor &&other);
@@ -24,6 +28,11 @@ struct file_descriptor {
 
     long write(void const *message, size_t message_size) const;
 
+    // Scatter read and gather write. Return values are the same as in read and write
+    long readv(iovec const *parts, int parts_number) const;
+
+    long writev(iovec const *parts, int parts_number) const;
+
     friend void swap(file_descriptor &first, file_descriptor &second);
 
     friend std::string to_string(file_descriptor const &fd);
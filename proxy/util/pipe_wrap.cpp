@@ -0,0 +1,65 @@
+#include "pipe_wrap.h"
+#include "annotated_exception.h"
+#include <fcntl.h>
+
+
+namespace {
+    long splice_between(int from, int to, size_t length) {
+        long moved = splice(from, 0, to, 0, length, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (moved == -1) {
+            int err = errno;
+            if (err == EAGAIN || err == EWOULDBLOCK) {
+                return file_descriptor::WOULD_BLOCK;
+            }
+            throw annotated_exception("splice", err);
+        }
+        return moved;
+    }
+}
+
+pipe_wrap::pipe_wrap() : pipe_wrap(create_pipe()) {}
+
+pipe_wrap::pipe_wrap(std::pair<int, int> ends) : read_end(ends.first), write_end(ends.second), size(0) {
+    int pipe_size = fcntl(write_end.get(), F_GETPIPE_SZ);
+    if (pipe_size == -1) {
+        int err = errno;
+        throw annotated_exception("pipe size", err);
+    }
+    size = (size_t) pipe_size;
+}
+
+pipe_wrap::pipe_wrap(pipe_wrap &&other) : read_end(std::move(other.read_end)), write_end(std::move(other.write_end)),
+                                          size(other.size) {}
+
+pipe_wrap &pipe_wrap::operator=(pipe_wrap &&other) {
+    swap(*this, other);
+    return *this;
+}
+
+long pipe_wrap::splice_from(file_descriptor const &from, size_t length) const {
+    return splice_between(from.get(), write_end.get(), length);
+}
+
+long pipe_wrap::splice_to(file_descriptor const &to, size_t length) const {
+    return splice_between(read_end.get(), to.get(), length);
+}
+
+std::pair<int, int> pipe_wrap::create_pipe() {
+    int ends[2];
+    if (pipe2(ends, O_NONBLOCK | O_CLOEXEC) == -1) {
+        int err = errno;
+        throw annotated_exception("pipe", err);
+    }
+    return {ends[0], ends[1]};
+}
+
+size_t pipe_wrap::capacity() const {
+    return size;
+}
+
+void swap(pipe_wrap &first, pipe_wrap &second) {
+    using std::swap;
+    swap(first.read_end, second.read_end);
+    swap(first.write_end, second.write_end);
+    swap(first.size, second.size);
+}
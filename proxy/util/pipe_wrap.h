@@ -0,0 +1,36 @@
+#ifndef PROXY_SERVER_PIPE_WRAP_H
+#define PROXY_SERVER_PIPE_WRAP_H
+
+#include <utility>
+#include "file_descriptor.h"
+
+// Non-blocking pipe. It's used for moving data between sockets by splice without copying it to user space
+struct pipe_wrap {
+    pipe_wrap();
+
+    pipe_wrap(pipe_wrap &&other);
+
+    pipe_wrap &operator=(pipe_wrap &&other);
+
+    // Move data from descriptor to pipe or from pipe to descriptor.
+    // Return number of moved bytes (0 at the end of file) or file_descriptor::WOULD_BLOCK
+    long splice_from(file_descriptor const &from, size_t length) const;
+
+    long splice_to(file_descriptor const &to, size_t length) const;
+
+    // Number of bytes, that pipe can hold
+    size_t capacity() const;
+
+    friend void swap(pipe_wrap &first, pipe_wrap &second);
+
+private:
+    explicit pipe_wrap(std::pair<int, int> ends);
+
+    static std::pair<int, int> create_pipe();
+
+    file_descriptor read_end, write_end;
+    size_t size;
+};
+
+
+#endif //PROXY_SERVER_PIPE_WRAP_H
@@ -3,6 +3,7 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <fcntl.h>
+#include <linux/errqueue.h>
 
 
 socket_wrap::socket_wrap() :
@@ -71,6 +72,13 @@ socket_wrap socket_wrap::accept(std::initializer_list<socket_mode> mode) const {
     return socket_wrap(new_fd);
 }
 
+socket_wrap socket_wrap::from_accept(int result) {
+    if (result < 0) {
+        throw annotated_exception("accept", -result);
+    }
+    return socket_wrap(result);
+}
+
 void socket_wrap::bind(uint16_t port) const {
     sockaddr_in addr = {};
 
@@ -116,6 +124,91 @@ void socket_wrap::get_option(int name, void *res, socklen_t *res_len) const {
     }
 }
 
+void socket_wrap::set_option(int name, void const *value, socklen_t value_len) const {
+    if (setsockopt(fd, SOL_SOCKET, name, value, value_len) < 0) {
+        int err = errno;
+        throw annotated_exception("set_option", err);
+    }
+}
+
+void socket_wrap::reuse_port() const {
+    int enable = 1;
+    set_option(SO_REUSEPORT, &enable, sizeof enable);
+}
+
+void socket_wrap::busy_poll(unsigned microseconds) const {
+    int value = (int) microseconds;
+    set_option(SO_BUSY_POLL, &value, sizeof value);
+}
+
+void socket_wrap::zerocopy() const {
+    int enable = 1;
+    set_option(SO_ZEROCOPY, &enable, sizeof enable);
+}
+
+long socket_wrap::send_zerocopy(iovec const *parts, int parts_number) const {
+    msghdr message = {};
+    message.msg_iov = const_cast<iovec *>(parts);
+    message.msg_iovlen = (size_t) parts_number;
+
+    long written = ::sendmsg(fd, &message, MSG_ZEROCOPY | MSG_NOSIGNAL);
+    if (written == -1) {
+        int err = errno;
+        if (err == EAGAIN || err == EWOULDBLOCK) {
+            return WOULD_BLOCK;
+        }
+        throw annotated_exception("send_zerocopy", err);
+    }
+    return written;
+}
+
+socket_wrap socket_wrap::duplicate() const {
+    int new_fd = ::dup(fd);
+    if (new_fd == -1) {
+        int err = errno;
+        throw annotated_exception("dup", err);
+    }
+    return socket_wrap(new_fd);
+}
+
+void socket_wrap::abort_on_close() const {
+    linger value = {1, 0};
+    set_option(SO_LINGER, &value, sizeof value);
+}
+
+zerocopy_completions socket_wrap::read_completions() const {
+    zerocopy_completions completions = {0, 0};
+    while (true) {
+        char control[CMSG_SPACE(sizeof(sock_extended_err)) * 4];
+        msghdr message = {};
+        message.msg_control = control;
+        message.msg_controllen = sizeof control;
+
+        if (::recvmsg(fd, &message, MSG_ERRQUEUE) == -1) {
+            int err = errno;
+            if (err == EAGAIN || err == EWOULDBLOCK) {
+                return completions;
+            }
+            throw annotated_exception("read_completions", err);
+        }
+        for (cmsghdr *cm = CMSG_FIRSTHDR(&message); cm != nullptr; cm = CMSG_NXTHDR(&message, cm)) {
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+            sock_extended_err const *error = reinterpret_cast<sock_extended_err const *>(CMSG_DATA(cm));
+            if (error->ee_origin != SO_EE_ORIGIN_ZEROCOPY || error->ee_errno != 0) {
+                continue;
+            }
+            // Sends from ee_info to ee_data (inclusive) are completed
+            size_t sends = (uint32_t) (error->ee_data - error->ee_info) + 1;
+            completions.sends += sends;
+            if (error->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                completions.copied += sends;
+            }
+        }
+    }
+}
 
 std::string to_string(socket_wrap &wrap) {
     return "socket " + std::to_string(wrap.get());
@@ -9,6 +9,12 @@ struct adress_t {
 
 };
 
+// Completions of zero-copy sends, that were read from error queue of socket
+struct zerocopy_completions {
+    size_t sends;   // Number of completed sends. They are completed in order of calls
+    size_t copied;  // Number of them, whose data was copied by kernel anyway (loopback, device without offloads)
+};
+
 struct socket_wrap : file_descriptor {
     enum socket_mode {
         NONBLOCK, CLOEXEC, SIMPLE
@@ -25,6 +31,9 @@ struct socket_wrap : file_descriptor {
 
     socket_wrap accept(std::initializer_list<socket_mode> mode) const;
 
+    // Take result of accept, that was made elsewhere (by io_uring): descriptor or negated error number
+    static socket_wrap from_accept(int result);
+
     // Bing to port
     void bind(uint16_t port) const;
 
@@ -37,6 +46,31 @@ struct socket_wrap : file_descriptor {
     // Method that calls getsockopt
     void get_option(int name, void *res, socklen_t *res_len) const;
 
+    // Method that calls setsockopt
+    void set_option(int name, void const *value, socklen_t value_len) const;
+
+    // Allow several sockets to be bound to the same port (SO_REUSEPORT). Should be called before bind
+    void reuse_port() const;
+
+    // Busy poll device queue on blocking reads (SO_BUSY_POLL). Raising it above net.core.busy_read needs CAP_NET_ADMIN
+    void busy_poll(unsigned microseconds) const;
+
+    // Allow sends with MSG_ZEROCOPY (SO_ZEROCOPY). Needs Linux 4.14
+    void zerocopy() const;
+
+    // Gather write with MSG_ZEROCOPY. Return values are the same as in writev. Sent memory is read by kernel
+    // until send is completed, so it mustn't be changed or freed before that
+    long send_zerocopy(iovec const *parts, int parts_number) const;
+
+    // Read all completions, that are in error queue. Completions are reported by EPOLLERR without SO_ERROR
+    zerocopy_completions read_completions() const;
+
+    // Another descriptor of the same socket (dup). Socket is closed, when all its descriptors are closed
+    socket_wrap duplicate() const;
+
+    // Reset connection on close (SO_LINGER with zero timeout), so data, that isn't sent yet, is dropped
+    void abort_on_close() const;
+
     friend std::string to_string(socket_wrap &wrap);
 
 protected:
@@ -1,7 +1,8 @@
 #include "util.h"
+#include "byte_scan.h"
 
 
 std::string to_lower(std::string other) {
-    std::transform(other.begin(), other.end(), other.begin(), ::tolower);
+    byte_scan::to_lower(&other[0], &other[0] + other.size());
     return other;
 }
\ No newline at end of file